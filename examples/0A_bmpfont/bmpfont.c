@@ -69,22 +69,10 @@ int main(int argc, char **argv)
     efi_status_t status;
     efi_guid_t gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
     efi_gop_t *gop = NULL;
-    FILE *f;
-    long int size;
+    size_t size;
 
     /* load font */
-    if((f = fopen("\\0A_bmpfont\\font.sfn", "r"))) {
-        fseek(f, 0, SEEK_END);
-        size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        font = (ssfn_font_t*)malloc(size + 1);
-        if(!font) {
-            fprintf(stderr, "unable to allocate memory\n");
-            return 1;
-        }
-        fread(font, size, 1, f);
-        fclose(f);
-    } else {
+    if(!(font = (ssfn_font_t*)map_file("\\0A_bmpfont\\font.sfn", &size))) {
         fprintf(stderr, "Unable to load font\n");
         return 0;
     }
@@ -113,6 +101,6 @@ int main(int argc, char **argv)
     printString(10, 10, "Hello 多种语言 Многоязычный többnyelvű World!");
 
     /* free resources exit */
-    free(font);
+    unmap_file(font, size);
     return 0;
 }
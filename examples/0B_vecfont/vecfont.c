@@ -27,27 +27,15 @@ int main(int argc, char **argv)
     efi_status_t status;
     efi_guid_t gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
     efi_gop_t *gop = NULL;
-    FILE *f;
     ssfn_font_t *font;
-    long int size;
+    size_t size;
 
     /* load font */
-    if((f = fopen("\\0B_vecfont\\font.sfn", "r"))) {
-        fseek(f, 0, SEEK_END);
-        size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        font = (ssfn_font_t*)malloc(size + 1);
-        if(!font) {
-            fprintf(stderr, "unable to allocate memory\n");
-            return 1;
-        }
-        fread(font, size, 1, f);
-        fclose(f);
-        ssfn_load(&ctx, font);
-    } else {
+    if(!(font = (ssfn_font_t*)map_file("\\0B_vecfont\\font.sfn", &size))) {
         fprintf(stderr, "Unable to load font\n");
         return 0;
     }
+    ssfn_load(&ctx, font);
 
     /* set video mode */
     status = BS->LocateProtocol(&gopGuid, NULL, (void**)&gop);
@@ -78,6 +66,6 @@ int main(int argc, char **argv)
 
     /* free resources exit */
     ssfn_free(&ctx);
-    free(font);
+    unmap_file(font, size);
     return 0;
 }
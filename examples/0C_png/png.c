@@ -12,39 +12,27 @@ int main(int argc, char **argv)
     efi_status_t status;
     efi_guid_t gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
     efi_gop_t *gop = NULL;
-    FILE *f;
     unsigned char *buff;
     uint32_t *data;
     int w, h, l;
-    long int size;
+    size_t size;
     stbi__context s;
     stbi__result_info ri;
 
     /* load image */
-    if((f = fopen("\\0C_png\\image.png", "r"))) {
-        fseek(f, 0, SEEK_END);
-        size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        buff = (unsigned char*)malloc(size);
-        if(!buff) {
-            fprintf(stderr, "unable to allocate memory\n");
-            return 1;
-        }
-        fread(buff, size, 1, f);
-        fclose(f);
-        ri.bits_per_channel = 8;
-        s.read_from_callbacks = 0;
-        s.img_buffer = s.img_buffer_original = buff;
-        s.img_buffer_end = s.img_buffer_original_end = buff + size;
-        data = (uint32_t*)stbi__png_load(&s, &w, &h, &l, 4, &ri);
-        if(!data) {
-            fprintf(stdout, "Unable to decode png: %s\n", stbi__g_failure_reason);
-            return 0;
-        }
-    } else {
+    if(!(buff = (unsigned char*)map_file("\\0C_png\\image.png", &size))) {
         fprintf(stderr, "Unable to load image\n");
         return 0;
     }
+    ri.bits_per_channel = 8;
+    s.read_from_callbacks = 0;
+    s.img_buffer = s.img_buffer_original = buff;
+    s.img_buffer_end = s.img_buffer_original_end = buff + size;
+    data = (uint32_t*)stbi__png_load(&s, &w, &h, &l, 4, &ri);
+    if(!data) {
+        fprintf(stdout, "Unable to decode png: %s\n", stbi__g_failure_reason);
+        return 0;
+    }
 
     /* set video mode */
     status = BS->LocateProtocol(&gopGuid, NULL, (void**)&gop);
@@ -73,6 +61,6 @@ int main(int argc, char **argv)
 
     /* free resources exit */
     free(data);
-    free(buff);
+    unmap_file(buff, size);
     return 0;
 }
@@ -53,27 +53,15 @@ int main(int argc, char **argv)
 {
     (void)argc;
     (void)argv;
-    FILE *f;
     char *buff;
-    long int size;
+    size_t size;
     Elf64_Ehdr *elf;
     Elf64_Phdr *phdr;
     uintptr_t entry;
     int i;
 
     /* load the file */
-    if((f = fopen("\\0E_elfload\\kernel.elf", "r"))) {
-        fseek(f, 0, SEEK_END);
-        size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        buff = malloc(size + 1);
-        if(!buff) {
-            fprintf(stderr, "unable to allocate memory\n");
-            return 1;
-        }
-        fread(buff, size, 1, f);
-        fclose(f);
-    } else {
+    if(!(buff = map_file("\\0E_elfload\\kernel.elf", &size))) {
         fprintf(stderr, "Unable to open file\n");
         return 0;
     }
@@ -103,7 +91,7 @@ int main(int argc, char **argv)
         return 0;
     }
     /* free resources */
-    free(buff);
+    unmap_file(buff, size);
 
     /* execute the "kernel" */
     printf("ELF entry point %p\n", entry);
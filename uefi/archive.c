@@ -0,0 +1,615 @@
+/*
+ * archive.c
+ *
+ * Copyright (C) 2021 bzt (bztsrc@gitlab)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the POSIX-UEFI package.
+ * @brief Read-only file system over a cpio or tar archive in memory
+ *
+ */
+
+#include <uefi.h>
+
+/* Like tmpfs, this is an implementation of the file protocol, so stdio, dirent and stat work on it unchanged. The archive
+ * is indexed once when mounted: every entry gets a slot with a pointer to its data, and full paths are hashed to slots.
+ * Directories missing from the archive are added, so that every file can be listed */
+
+#define __ARC_NONE      0xffffffffU
+#define __ARC_HASHMIN   64
+#define __ARC_INFOSIZE  ((uintn_t)&((efi_file_info_t*)0)->FileName)
+
+typedef struct {
+    const char *name;               /* full path in the archive, not zero terminated, "" for the root */
+    uint32_t len;
+    uint32_t hnext;                 /* next in the hash bucket */
+    uint32_t parent;
+    uint32_t child, last;           /* directories, first and last entry in archive order */
+    uint32_t sibling;               /* next entry in the same directory */
+    uint64_t attr;
+    uint64_t size;
+    uint8_t *data;                  /* points into the archive */
+    efi_time_t mtime;
+} __arcent_t;
+
+/* tar names joined with their ustar prefix, entry names point here */
+typedef struct __arcname_s {
+    struct __arcname_s *next;
+    char name[256];
+} __arcname_t;
+
+typedef struct {
+    uint8_t *buf;                   /* the archive as loaded by map_file */
+    size_t size;
+    __arcent_t *ent;
+    uint32_t nent, aent;
+    uint32_t *tab;
+    uint32_t nbuck;
+    __arcname_t *names;
+    uintn_t refs;                   /* open handles, the archive is freed with the last one */
+} __arc_t;
+
+typedef struct {
+    efi_file_handle_t fh;           /* must be the first, handles are passed around as efi_file_handle_t */
+    __arc_t *arc;
+    uint32_t ent;
+    uint32_t cur;                   /* directories, the next entry to read */
+    uint64_t pos;
+} __arcfh_t;
+
+static efi_file_handle_t *__arc_handle(__arc_t *arc, uint32_t ent);
+
+static uint32_t __arc_hash(const char *s, uintn_t len)
+{
+    uint32_t h = 2166136261U;
+    for(; len; len--, s++)
+        h = (h ^ (uint8_t)*s) * 16777619U;
+    return h;
+}
+
+static uint32_t __arc_find(__arc_t *arc, const char *name, uintn_t len)
+{
+    uint32_t i;
+    for(i = arc->tab[__arc_hash(name, len) & (arc->nbuck - 1)]; i != __ARC_NONE; i = arc->ent[i].hnext)
+        if(arc->ent[i].len == len && !memcmp(arc->ent[i].name, name, len))
+            return i;
+    return __ARC_NONE;
+}
+
+/* archives store seconds since the epoch, convert that to a calendar date */
+static void __arc_time(uint64_t t, efi_time_t *e)
+{
+    uint64_t d = t / 86400 + 719468, era, doe, yoe, doy, mp, y, m;
+    memset(e, 0, sizeof(efi_time_t));
+    era = d / 146097;
+    doe = d - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+    e->Year = (uint16_t)y;
+    e->Month = (uint8_t)m;
+    e->Day = (uint8_t)(doy - (153 * mp + 2) / 5 + 1);
+    e->Hour = (uint8_t)(t % 86400 / 3600);
+    e->Minute = (uint8_t)(t % 3600 / 60);
+    e->Second = (uint8_t)(t % 60);
+}
+
+/* add an entry, and its parent directories if they are missing. A later entry with the same path replaces the earlier
+ * one, like when extracting, except that a file never replaces a directory, because that would orphan its entries. Returns the entry's index, or __ARC_NONE if we're out of memory */
+static uint32_t __arc_add(__arc_t *arc, const char *name, uintn_t len, uint64_t attr, uint8_t *data, uint64_t size,
+    uint64_t mtime)
+{
+    __arcent_t *ent;
+    uint32_t *tab, i, h, p;
+    uintn_t l;
+    /* no leading "./" or "/", nor trailing "/" */
+    while(len && (name[0] == '/' || (name[0] == '.' && (len == 1 || name[1] == '/')))) { name++; len--; }
+    while(len && name[len - 1] == '/') len--;
+    if((i = __arc_find(arc, name, len)) == __ARC_NONE) {
+        for(l = len; l && name[l - 1] != '/'; l--);
+        if((p = __arc_find(arc, name, l ? l - 1 : 0)) == __ARC_NONE &&
+          (p = __arc_add(arc, name, l ? l - 1 : 0, EFI_FILE_DIRECTORY, NULL, 0, 0)) == __ARC_NONE)
+            return __ARC_NONE;
+        /* nothing can be below a file */
+        if(!(arc->ent[p].attr & EFI_FILE_DIRECTORY))
+            return p;
+        if(arc->nent >= arc->aent) {
+            if(!(ent = (__arcent_t*)realloc(arc->ent, 2 * arc->aent * sizeof(__arcent_t)))) return __ARC_NONE;
+            arc->ent = ent;
+            arc->aent *= 2;
+        }
+        /* keep the hash table at most one entry per bucket */
+        if(arc->nent >= arc->nbuck) {
+            if(!(tab = (uint32_t*)malloc(2 * arc->nbuck * sizeof(uint32_t)))) return __ARC_NONE;
+            free(arc->tab);
+            arc->tab = tab;
+            arc->nbuck *= 2;
+            memset(tab, 0xff, arc->nbuck * sizeof(uint32_t));
+            for(i = 0; i < arc->nent; i++) {
+                h = __arc_hash(arc->ent[i].name, arc->ent[i].len) & (arc->nbuck - 1);
+                arc->ent[i].hnext = tab[h];
+                tab[h] = i;
+            }
+        }
+        i = arc->nent++;
+        ent = &arc->ent[i];
+        memset(ent, 0, sizeof(__arcent_t));
+        ent->name = name;
+        ent->len = (uint32_t)len;
+        ent->child = ent->last = ent->sibling = __ARC_NONE;
+        __arc_time(0, &ent->mtime);
+        h = __arc_hash(name, len) & (arc->nbuck - 1);
+        ent->hnext = arc->tab[h];
+        arc->tab[h] = i;
+        ent->parent = p;
+        if(arc->ent[p].last != __ARC_NONE) arc->ent[arc->ent[p].last].sibling = i;
+        else arc->ent[p].child = i;
+        arc->ent[p].last = i;
+    }
+    ent = &arc->ent[i];
+    if((ent->attr & EFI_FILE_DIRECTORY) && !(attr & EFI_FILE_DIRECTORY))
+        return i;
+    if(mtime)
+        __arc_time(mtime, &ent->mtime);
+    if(!(ent->attr & EFI_FILE_DIRECTORY)) {
+        ent->attr = attr | EFI_FILE_READ_ONLY;
+        ent->data = data;
+        ent->size = size;
+    }
+    return i;
+}
+
+/* numeric header fields. Tar uses octal, or big endian binary for huge values, cpio uses hex */
+static uint64_t __arc_oct(const uint8_t *s, uintn_t n)
+{
+    uint64_t r = 0;
+    if(*s & 0x80) {
+        for(r = *s++ & 0x7f, n--; n; n--, s++) r = (r << 8) | *s;
+        return r;
+    }
+    for(; n && *s == ' '; n--, s++);
+    for(; n && *s >= '0' && *s <= '7'; n--, s++) r = (r << 3) | (uint64_t)(*s - '0');
+    return r;
+}
+
+static uint64_t __arc_hex(const uint8_t *s)
+{
+    uint64_t r = 0;
+    uintn_t n;
+    for(n = 0; n < 8; n++, s++)
+        r = (r << 4) | (uint64_t)(*s >= 'a' ? *s - 'a' + 10 : (*s >= 'A' ? *s - 'A' + 10 : *s - '0'));
+    return r;
+}
+
+static uintn_t __arc_strnlen(const uint8_t *s, uintn_t n)
+{
+    uintn_t i;
+    for(i = 0; i < n && s[i]; i++);
+    return i;
+}
+
+/* SVR4 "newc" cpio, as made by cpio -H newc and used for Linux initramfs */
+static int __arc_cpio(__arc_t *arc)
+{
+    uint8_t *h;
+    uint64_t mode, size, nsize, data, off = 0;
+    while(off + 110 <= arc->size) {
+        h = arc->buf + off;
+        if(memcmp(h, "07070", 5) || (h[5] != '1' && h[5] != '2'))
+            return EINVAL;
+        mode = __arc_hex(h + 14);
+        size = __arc_hex(h + 54);
+        nsize = __arc_hex(h + 94);
+        data = (off + 110 + nsize + 3) & ~3ULL;
+        if(!nsize || data > arc->size || size > arc->size - data)
+            return EINVAL;
+        if(nsize == 11 && !memcmp(h + 110, "TRAILER!!!", 10))
+            break;
+        if(((mode & 0170000) == 0040000 || (mode & 0170000) == 0100000) &&
+          __arc_add(arc, (const char*)h + 110, (uintn_t)nsize - 1, (mode & 0170000) == 0040000 ? EFI_FILE_DIRECTORY : 0,
+          arc->buf + data, size, __arc_hex(h + 46)) == __ARC_NONE)
+            return ENOMEM;
+        off = (data + size + 3) & ~3ULL;
+    }
+    return 0;
+}
+
+/* POSIX ustar with GNU long names and pax path records, plain old tar too */
+static int __arc_tar(__arc_t *arc)
+{
+    uint8_t *h, *s, *e, type;
+    uint64_t size = 0, sum, off, mtime;
+    const char *lname = NULL;
+    __arcname_t *n;
+    uintn_t i, len = 0, plen;
+    for(off = 0; off + 512 <= arc->size; off += 512 + ((size + 511) & ~511ULL)) {
+        h = arc->buf + off;
+        /* the archive ends with zero blocks */
+        if(!h[0]) break;
+        for(i = sum = 0; i < 512; i++)
+            sum += i >= 148 && i < 156 ? ' ' : h[i];
+        size = __arc_oct(h + 124, 12);
+        if(sum != __arc_oct(h + 148, 8) || size > arc->size - off - 512)
+            return EINVAL;
+        switch(h[156]) {
+            case 'L':
+                lname = (const char*)h + 512;
+                len = __arc_strnlen(h + 512, (uintn_t)size);
+                continue;
+            case 'x':
+                /* records are "length key=value\n" */
+                for(s = h + 512; s < h + 512 + size; s = e) {
+                    for(e = s, i = 0; e < h + 512 + size && *e >= '0' && *e <= '9'; e++) i = i * 10 + (uintn_t)(*e - '0');
+                    if(!i || i > (uintn_t)(h + 512 + size - s)) break;
+                    e = s + i;
+                    for(s += 1; s < e && s[-1] != ' '; s++);
+                    if(e - s > 6 && !memcmp(s, "path=", 5)) {
+                        lname = (const char*)s + 5;
+                        len = (uintn_t)(e - s - 6);
+                    }
+                }
+                continue;
+            case 0: case '0': case '5': case '7':
+                break;
+            default:
+                /* links, devices and global headers are skipped */
+                lname = NULL;
+                continue;
+        }
+        type = h[156];
+        mtime = __arc_oct(h + 136, 12);
+        if(!lname) {
+            lname = (const char*)h;
+            len = __arc_strnlen(h, 100);
+            /* a POSIX prefix is joined with the name. Entry names must outlive the loop, so the arc keeps the result */
+            if(!memcmp(h + 257, "ustar", 6) && h[345]) {
+                if(!(n = (__arcname_t*)malloc(sizeof(__arcname_t)))) return ENOMEM;
+                n->next = arc->names;
+                arc->names = n;
+                plen = __arc_strnlen(h + 345, 155);
+                memcpy(n->name, h + 345, plen);
+                n->name[plen] = '/';
+                memcpy(n->name + plen + 1, h, len);
+                len += plen + 1;
+                lname = n->name;
+            }
+        }
+        if(__arc_add(arc, lname, len, type == '5' || (len && lname[len - 1] == '/') ? EFI_FILE_DIRECTORY : 0,
+          h + 512, type == '5' ? 0 : size, mtime) == __ARC_NONE)
+            return ENOMEM;
+        lname = NULL;
+    }
+    return 0;
+}
+
+static void __arc_free(__arc_t *arc)
+{
+    __arcname_t *n;
+    while((n = arc->names)) {
+        arc->names = n->next;
+        free(n);
+    }
+    if(arc->ent) free(arc->ent);
+    if(arc->tab) free(arc->tab);
+    free(arc);
+}
+
+static void __arc_release(__arc_t *arc)
+{
+    if(--arc->refs) return;
+    unmap_file(arc->buf, arc->size);
+    __arc_free(arc);
+}
+
+/* archive names are UTF-8, file protocol names are UCS-2. Returns the number of bytes, 0 if it doesn't fit */
+static uintn_t __arc_enc(char *out, const wchar_t *s, uintn_t n, uintn_t max)
+{
+    uintn_t len = 0;
+    for(; n; n--, s++) {
+        if(len + 3 > max) return 0;
+        if(*s < 0x80)
+            out[len++] = (char)*s;
+        else if(*s < 0x800) {
+            out[len++] = (char)(0xC0 | (*s >> 6));
+            out[len++] = (char)(0x80 | (*s & 0x3F));
+        } else {
+            out[len++] = (char)(0xE0 | (*s >> 12));
+            out[len++] = (char)(0x80 | ((*s >> 6) & 0x3F));
+            out[len++] = (char)(0x80 | (*s & 0x3F));
+        }
+    }
+    return len;
+}
+
+/* the other way around, returns the number of characters. Only counts them if out is NULL */
+static uintn_t __arc_dec(wchar_t *out, const char *s, uintn_t len)
+{
+    const uint8_t *p = (const uint8_t*)s, *e = p + len;
+    uintn_t n;
+    uint32_t c;
+    for(n = 0; p < e; n++) {
+        c = *p++;
+        if(c >= 0xF0) {
+            /* outside of UCS-2 */
+            for(c = '?'; p < e && (*p & 0xC0) == 0x80; p++);
+        } else if(c >= 0xE0 && e - p >= 2) {
+            c = ((c & 0x0F) << 12) | ((uint32_t)(p[0] & 0x3F) << 6) | (p[1] & 0x3F);
+            p += 2;
+        } else if(c >= 0xC0 && e - p >= 1) {
+            c = ((c & 0x1F) << 6) | (p[0] & 0x3F);
+            p++;
+        }
+        if(out) out[n] = (wchar_t)c;
+    }
+    return n;
+}
+
+static uintn_t __arc_info(__arcent_t *ent, efi_file_info_t *info, uintn_t bufsiz)
+{
+    const char *name = ent->name;
+    uintn_t len = ent->len, n;
+    while(len && name[len - 1] != '/') len--;
+    name += len;
+    len = ent->len - len;
+    n = __ARC_INFOSIZE + (__arc_dec(NULL, name, len) + 1) * sizeof(wchar_t);
+    if(bufsiz < n) return n;
+    memset(info, 0, __ARC_INFOSIZE);
+    info->Size = n;
+    info->FileSize = info->PhysicalSize = ent->size;
+    memcpy(&info->CreateTime, &ent->mtime, sizeof(efi_time_t));
+    memcpy(&info->LastAccessTime, &ent->mtime, sizeof(efi_time_t));
+    memcpy(&info->ModificationTime, &ent->mtime, sizeof(efi_time_t));
+    info->Attribute = ent->attr;
+    info->FileName[__arc_dec(info->FileName, name, len)] = 0;
+    return n;
+}
+
+static efi_status_t EFIAPI __arc_open(efi_file_handle_t *File, efi_file_handle_t **NewHandle, wchar_t *FileName,
+    uint64_t OpenMode, uint64_t Attributes)
+{
+    __arcfh_t *h = (__arcfh_t*)File;
+    __arcent_t *ent;
+    char path[3 * FILENAME_MAX];
+    wchar_t *s = FileName, *e;
+    uintn_t len = 0, l;
+    uint32_t i;
+    (void)Attributes;
+    if(!File || !NewHandle || !FileName)
+        return EFI_INVALID_PARAMETER;
+    if(OpenMode & (EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE))
+        return EFI_WRITE_PROTECTED;
+    /* make it a path from the root of the archive */
+    if(*s != L'\\' && *s != L'/') {
+        ent = &h->arc->ent[h->ent];
+        if((len = ent->len) >= sizeof(path))
+            return EFI_NOT_FOUND;
+        memcpy(path, ent->name, len);
+    }
+    for(;;) {
+        while(*s == L'\\' || *s == L'/') s++;
+        if(!*s) break;
+        for(e = s; *e && *e != L'\\' && *e != L'/'; e++);
+        if(e - s == 2 && s[0] == L'.' && s[1] == L'.') {
+            while(len && path[len - 1] != '/') len--;
+            if(len) len--;
+        } else
+        if(e - s != 1 || s[0] != L'.') {
+            if(len) {
+                if(len + 1 >= sizeof(path))
+                    return EFI_NOT_FOUND;
+                path[len++] = '/';
+            }
+            if(!(l = __arc_enc(path + len, s, (uintn_t)(e - s), sizeof(path) - len)))
+                return EFI_NOT_FOUND;
+            len += l;
+        }
+        s = e;
+    }
+    if((i = __arc_find(h->arc, path, len)) == __ARC_NONE)
+        return EFI_NOT_FOUND;
+    *NewHandle = __arc_handle(h->arc, i);
+    return *NewHandle ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+static efi_status_t EFIAPI __arc_close(efi_file_handle_t *File)
+{
+    __arcfh_t *h = (__arcfh_t*)File;
+    if(!h) return EFI_INVALID_PARAMETER;
+    __arc_release(h->arc);
+    free(h);
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __arc_delete(efi_file_handle_t *File)
+{
+    __arc_close(File);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+static efi_status_t EFIAPI __arc_read(efi_file_handle_t *File, uintn_t *BufferSize, void *Buffer)
+{
+    __arcfh_t *h = (__arcfh_t*)File;
+    __arcent_t *ent = &h->arc->ent[h->ent];
+    uintn_t n;
+    if(!BufferSize || (*BufferSize && !Buffer))
+        return EFI_INVALID_PARAMETER;
+    if(ent->attr & EFI_FILE_DIRECTORY) {
+        if(h->cur == __ARC_NONE) {
+            *BufferSize = 0;
+            return EFI_SUCCESS;
+        }
+        n = __arc_info(&h->arc->ent[h->cur], (efi_file_info_t*)Buffer, *BufferSize);
+        if(*BufferSize < n) {
+            *BufferSize = n;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        *BufferSize = n;
+        h->cur = h->arc->ent[h->cur].sibling;
+        return EFI_SUCCESS;
+    }
+    if(h->pos > ent->size)
+        return EFI_DEVICE_ERROR;
+    if(*BufferSize > ent->size - h->pos)
+        *BufferSize = (uintn_t)(ent->size - h->pos);
+    memcpy(Buffer, ent->data + h->pos, *BufferSize);
+    h->pos += *BufferSize;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __arc_write(efi_file_handle_t *File, uintn_t *BufferSize, void *Buffer)
+{
+    (void)File; (void)Buffer;
+    if(BufferSize) *BufferSize = 0;
+    return EFI_WRITE_PROTECTED;
+}
+
+static efi_status_t EFIAPI __arc_getpos(efi_file_handle_t *File, uint64_t *Position)
+{
+    __arcfh_t *h = (__arcfh_t*)File;
+    if(!Position)
+        return EFI_INVALID_PARAMETER;
+    if(h->arc->ent[h->ent].attr & EFI_FILE_DIRECTORY)
+        return EFI_UNSUPPORTED;
+    *Position = h->pos;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __arc_setpos(efi_file_handle_t *File, uint64_t Position)
+{
+    __arcfh_t *h = (__arcfh_t*)File;
+    __arcent_t *ent = &h->arc->ent[h->ent];
+    if(ent->attr & EFI_FILE_DIRECTORY) {
+        /* directories can only be rewound */
+        if(Position)
+            return EFI_UNSUPPORTED;
+        h->cur = ent->child;
+        return EFI_SUCCESS;
+    }
+    h->pos = Position == (uint64_t)-1 ? ent->size : Position;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __arc_getinfo(efi_file_handle_t *File, efi_guid_t *InformationType, uintn_t *BufferSize,
+    void *Buffer)
+{
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    __arcfh_t *h = (__arcfh_t*)File;
+    uintn_t n;
+    if(!InformationType || !BufferSize)
+        return EFI_INVALID_PARAMETER;
+    if(memcmp(InformationType, &infGuid, sizeof(efi_guid_t)))
+        return EFI_UNSUPPORTED;
+    n = __arc_info(&h->arc->ent[h->ent], (efi_file_info_t*)Buffer, Buffer ? *BufferSize : 0);
+    if(*BufferSize < n || !Buffer) {
+        *BufferSize = n;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    *BufferSize = n;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __arc_setinfo(efi_file_handle_t *File, efi_guid_t *InformationType, uintn_t BufferSize,
+    void *Buffer)
+{
+    (void)File; (void)InformationType; (void)BufferSize; (void)Buffer;
+    return EFI_WRITE_PROTECTED;
+}
+
+static efi_status_t EFIAPI __arc_flush(efi_file_handle_t *File)
+{
+    (void)File;
+    return EFI_SUCCESS;
+}
+
+static efi_file_handle_t *__arc_handle(__arc_t *arc, uint32_t ent)
+{
+    __arcfh_t *h = (__arcfh_t*)malloc(sizeof(__arcfh_t));
+    if(!h) return NULL;
+    memset(h, 0, sizeof(__arcfh_t));
+    h->fh.Revision = EFI_FILE_PROTOCOL_REVISION;
+    h->fh.Open = __arc_open;
+    h->fh.Close = __arc_close;
+    h->fh.Delete = __arc_delete;
+    h->fh.Read = __arc_read;
+    h->fh.Write = __arc_write;
+    h->fh.GetPosition = __arc_getpos;
+    h->fh.SetPosition = __arc_setpos;
+    h->fh.GetInfo = __arc_getinfo;
+    h->fh.SetInfo = __arc_setinfo;
+    h->fh.Flush = __arc_flush;
+    h->arc = arc;
+    h->ent = ent;
+    h->cur = arc->ent[ent].child;
+    arc->refs++;
+    return &h->fh;
+}
+
+/* index an archive loaded by map_file and return a handle to its root directory. On success the archive belongs to us,
+ * and it's unmapped when the last handle is closed */
+efi_file_handle_t *__archive_open(void *buf, size_t size)
+{
+    efi_file_handle_t *root;
+    __arc_t *arc;
+    int err;
+    if(!(arc = (__arc_t*)malloc(sizeof(__arc_t)))) goto nomem;
+    memset(arc, 0, sizeof(__arc_t));
+    arc->buf = (uint8_t*)buf;
+    arc->size = size;
+    arc->aent = arc->nbuck = __ARC_HASHMIN;
+    if(!(arc->ent = (__arcent_t*)malloc(arc->aent * sizeof(__arcent_t))) ||
+      !(arc->tab = (uint32_t*)malloc(arc->nbuck * sizeof(uint32_t))))
+        goto nomem;
+    memset(arc->tab, 0xff, arc->nbuck * sizeof(uint32_t));
+    /* the root is the first entry */
+    memset(arc->ent, 0, sizeof(__arcent_t));
+    arc->ent[0].name = "";
+    arc->ent[0].attr = EFI_FILE_DIRECTORY | EFI_FILE_READ_ONLY;
+    arc->ent[0].data = arc->buf;
+    arc->ent[0].parent = arc->ent[0].child = arc->ent[0].last = arc->ent[0].sibling = __ARC_NONE;
+    arc->ent[0].hnext = __ARC_NONE;
+    __arc_time(0, &arc->ent[0].mtime);
+    arc->tab[__arc_hash("", 0) & (arc->nbuck - 1)] = 0;
+    arc->nent = 1;
+    err = size >= 6 && !memcmp(buf, "07070", 5) ? __arc_cpio(arc) : __arc_tar(arc);
+    if(err) {
+        __arc_free(arc);
+        errno = err;
+        return NULL;
+    }
+    if(!(root = __arc_handle(arc, 0))) goto nomem;
+    return root;
+nomem:
+    if(arc) __arc_free(arc);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/* the data of a file opened in an archive, so that streams can read it without copying, NULL for other handles */
+void *__archive_data(efi_file_handle_t *fh)
+{
+    __arcfh_t *h = (__arcfh_t*)fh;
+    if(!fh || fh->Read != __arc_read || (h->arc->ent[h->ent].attr & EFI_FILE_DIRECTORY))
+        return NULL;
+    return h->arc->ent[h->ent].data;
+}
@@ -35,8 +35,14 @@ static struct dirent __dirent;
 
 DIR *opendir (const char_t *__name)
 {
-    DIR *dp = (DIR*)fopen(__name, CL("rd"));
-    if(dp) rewinddir(dp);
+    FILE *f = fopen(__name, CL("rd"));
+    DIR *dp = NULL;
+    /* directories are read entry by entry, no need for the FILE wrapper */
+    if(f) {
+        dp = f->fh;
+        free(f);
+        rewinddir(dp);
+    }
     return dp;
 }
 
@@ -70,7 +76,11 @@ void rewinddir (DIR *__dirp)
 
 int closedir (DIR *__dirp)
 {
-    return fclose((FILE*)__dirp);
+    if(!__dirp) {
+        errno = EINVAL;
+        return 0;
+    }
+    return !EFI_ERROR(__dirp->Close(__dirp));
 }
 
 
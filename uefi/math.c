@@ -0,0 +1,1260 @@
+/*
+ * math.c
+ *
+ * Copyright (C) 2021 bzt (bztsrc@gitlab)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the POSIX-UEFI package.
+ * @brief Implementing functions which are defined in math.h
+ *
+ */
+
+#include <uefi.h>
+
+/* the double precision algorithms are from musl (which took them from FreeBSD's fdlibm), they are accurate to 1 ulp */
+typedef union { double f; uint64_t i; } __math_dbl_t;
+typedef union { float f; uint32_t i; } __math_flt_t;
+#define HIWORD(x)       ((uint32_t)(((__math_dbl_t){x}).i >> 32))
+#define LOWORD(x)       ((uint32_t)((__math_dbl_t){x}).i)
+
+static const double
+    ln2_hi = 6.93147180369123816490e-01,    /* 3fe62e42 fee00000 */
+    ln2_lo = 1.90821492927058770002e-10,    /* 3dea39ef 35793c76 */
+    invln2 = 1.44269504088896338700e+00,    /* 3ff71547 652b82fe */
+    pi     = 3.14159265358979311600e+00,    /* 400921fb 54442d18 */
+    pi_lo  = 1.22464679914735317720e-16;    /* 3ca1a626 33145c07 */
+
+double fabs(double __x)
+{
+    __math_dbl_t u = { __x };
+    u.i &= -1ULL / 2;
+    return u.f;
+}
+
+double copysign(double __x, double __y)
+{
+    __math_dbl_t ux = { __x }, uy = { __y };
+    ux.i &= -1ULL / 2;
+    ux.i |= uy.i & 1ULL << 63;
+    return ux.f;
+}
+
+double trunc(double __x)
+{
+    __math_dbl_t u = { __x };
+    int e = (int)(u.i >> 52 & 0x7ff) - 0x3ff + 12;
+    uint64_t m;
+    if(e >= 52 + 12) return __x;
+    if(e < 12) e = 1;
+    m = -1ULL >> e;
+    if(!(u.i & m)) return __x;
+    u.i &= ~m;
+    return u.f;
+}
+
+double floor(double __x)
+{
+    double t = trunc(__x);
+    return __x < 0 && t != __x ? t - 1.0 : t;
+}
+
+double ceil(double __x)
+{
+    double t = trunc(__x);
+    return __x > 0 && t != __x ? t + 1.0 : t;
+}
+
+double round(double __x)
+{
+    double t = trunc(__x);
+    /* x - t is exact, it is the fractional part */
+    if(fabs(__x - t) >= 0.5) t += copysign(1.0, __x);
+    return t;
+}
+
+double fmod(double __x, double __y)
+{
+    __math_dbl_t ux = { __x }, uy = { __y };
+    int ex = ux.i >> 52 & 0x7ff, ey = uy.i >> 52 & 0x7ff, sx = ux.i >> 63;
+    uint64_t i, uxi = ux.i;
+
+    if(uy.i << 1 == 0 || __y != __y || ex == 0x7ff)
+        return (__x * __y) / (__x * __y);
+    if(uxi << 1 <= uy.i << 1) {
+        if(uxi << 1 == uy.i << 1) return 0 * __x;
+        return __x;
+    }
+    /* normalize x and y */
+    if(!ex) {
+        for(i = uxi << 12; i >> 63 == 0; ex--, i <<= 1);
+        uxi <<= -ex + 1;
+    } else {
+        uxi &= -1ULL >> 12;
+        uxi |= 1ULL << 52;
+    }
+    if(!ey) {
+        for(i = uy.i << 12; i >> 63 == 0; ey--, i <<= 1);
+        uy.i <<= -ey + 1;
+    } else {
+        uy.i &= -1ULL >> 12;
+        uy.i |= 1ULL << 52;
+    }
+    /* x mod y, bit by bit */
+    for(; ex > ey; ex--) {
+        i = uxi - uy.i;
+        if(i >> 63 == 0) {
+            if(i == 0) return 0 * __x;
+            uxi = i;
+        }
+        uxi <<= 1;
+    }
+    i = uxi - uy.i;
+    if(i >> 63 == 0) {
+        if(i == 0) return 0 * __x;
+        uxi = i;
+    }
+    for(; uxi >> 52 == 0; uxi <<= 1, ex--);
+    /* scale result */
+    if(ex > 0) {
+        uxi -= 1ULL << 52;
+        uxi |= (uint64_t)ex << 52;
+    } else
+        uxi >>= -ex + 1;
+    uxi |= (uint64_t)sx << 63;
+    ux.i = uxi;
+    return ux.f;
+}
+
+double ldexp(double __x, int __exp)
+{
+    __math_dbl_t u;
+    double y = __x;
+    if(__exp > 1023) {
+        y *= 0x1p1023; __exp -= 1023;
+        if(__exp > 1023) {
+            y *= 0x1p1023; __exp -= 1023;
+            if(__exp > 1023) __exp = 1023;
+        }
+    } else if(__exp < -1022) {
+        /* make sure the final result is rounded only once, so the first step doesn't go to subnormal */
+        y *= 0x1p-1022 * 0x1p53; __exp += 1022 - 53;
+        if(__exp < -1022) {
+            y *= 0x1p-1022 * 0x1p53; __exp += 1022 - 53;
+            if(__exp < -1022) __exp = -1022;
+        }
+    }
+    u.i = (uint64_t)(0x3ff + __exp) << 52;
+    return y * u.f;
+}
+
+double frexp(double __x, int *__exp)
+{
+    __math_dbl_t u = { __x };
+    int ee = u.i >> 52 & 0x7ff;
+    if(!ee) {
+        if(__x) {
+            __x = frexp(__x * 0x1p64, __exp);
+            *__exp -= 64;
+        } else *__exp = 0;
+        return __x;
+    } else if(ee == 0x7ff)
+        return __x;
+    *__exp = ee - 0x3fe;
+    u.i &= 0x800fffffffffffffULL;
+    u.i |= 0x3fe0000000000000ULL;
+    return u.f;
+}
+
+double sqrt(double __x)
+{
+#if defined(__x86_64__)
+    __asm__("sqrtsd %1, %0" : "=x"(__x) : "x"(__x));
+#elif defined(__aarch64__)
+    __asm__("fsqrt %d0, %d1" : "=w"(__x) : "w"(__x));
+#elif defined(__riscv)
+    __asm__("fsqrt.d %0, %1" : "=f"(__x) : "f"(__x));
+#else
+    double r;
+    int i;
+    if(__x <= 0 || __x != __x || __x > 1.7976931348623157e308) return __x == 0 ? __x : (__x > 0 ? __x : (__x - __x) / 0.0);
+    for(r = __x > 1 ? __x / 2 : 1, i = 0; i < 64; i++) r = (r + __x / r) / 2;
+    __x = r;
+#endif
+    return __x;
+}
+
+/* x*x as hi + lo exactly, splitting x into two 26 bit halves (Dekker) */
+static void __hypot_sq(double *hi, double *lo, double x)
+{
+    double xc = x * (0x1p27 + 1), xh = x - xc + xc, xl = x - xh;
+    *hi = x * x;
+    *lo = xh * xh - *hi + 2 * xh * xl + xl * xl;
+}
+
+double hypot(double __x, double __y)
+{
+    __math_dbl_t ux = { __x }, uy = { __y }, ut;
+    double hx, lx, hy, ly, z = 1;
+    int ex, ey;
+
+    /* arrange |x| >= |y| */
+    ux.i &= -1ULL >> 1;
+    uy.i &= -1ULL >> 1;
+    if(ux.i < uy.i) { ut = ux; ux = uy; uy = ut; }
+    ex = ux.i >> 52; ey = uy.i >> 52;
+    __x = ux.f; __y = uy.f;
+    /* hypot(inf, nan) is inf */
+    if(ey == 0x7ff) return __y;
+    if(ex == 0x7ff || !uy.i) return __x;
+    if(ex - ey > 64) return __x + __y;
+    /* scale so that the squares neither overflow nor lose their low parts, then the sum is exact enough for 1 ulp */
+    if(ex > 0x3ff + 510) { z = 0x1p700; __x *= 0x1p-700; __y *= 0x1p-700; }
+    else if(ey < 0x3ff - 450) { z = 0x1p-700; __x *= 0x1p700; __y *= 0x1p700; }
+    __hypot_sq(&hx, &lx, __x);
+    __hypot_sq(&hy, &ly, __y);
+    return z * sqrt(ly + lx + hy + hx);
+}
+
+double exp(double __x)
+{
+    static const double
+        P1 =  1.66666666666666019037e-01,
+        P2 = -2.77777777770155933842e-03,
+        P3 =  6.61375632143793436117e-05,
+        P4 = -1.65339022054652515390e-06,
+        P5 =  4.13813679705723846039e-08;
+    double hi, lo, c, xx, y;
+    int k, sign;
+    uint32_t hx = HIWORD(__x);
+
+    sign = hx >> 31;
+    hx &= 0x7fffffff;
+    /* special cases */
+    if(hx >= 0x4086232b) {                  /* |x| >= 708.39 or nan */
+        if(__x != __x) return __x;
+        if(__x > 709.782712893383973096) return __x * 0x1p1023;
+        if(__x < -745.13321910194110842) return 0;
+    }
+    /* argument reduction, x = k*ln2 + r, |r| <= 0.5*ln2 */
+    if(hx > 0x3fd62e42) {                   /* |x| > 0.5 ln2 */
+        if(hx >= 0x3ff0a2b2)                /* |x| >= 1.5 ln2 */
+            k = (int)(invln2 * __x + (sign ? -0.5 : 0.5));
+        else
+            k = 1 - sign - sign;
+        hi = __x - k * ln2_hi;
+        lo = k * ln2_lo;
+        __x = hi - lo;
+    } else if(hx > 0x3e300000) {            /* |x| > 2**-28 */
+        k = 0;
+        hi = __x;
+        lo = 0;
+    } else
+        return 1 + __x;
+    /* x is now in primary range */
+    xx = __x * __x;
+    c = __x - xx * (P1 + xx * (P2 + xx * (P3 + xx * (P4 + xx * P5))));
+    y = 1 + (__x * c / (2 - c) - lo + hi);
+    return k == 0 ? y : ldexp(y, k);
+}
+
+/* log of x's mantissa reduced into [sqrt(2)/2, sqrt(2)], the exponent is returned in k */
+static double __log_r(double x, int *k, int *special)
+{
+    static const double
+        Lg1 = 6.666666666666735130e-01,
+        Lg2 = 3.999999999940941908e-01,
+        Lg3 = 2.857142874366239149e-01,
+        Lg4 = 2.222219843214978396e-01,
+        Lg5 = 1.818357216161805012e-01,
+        Lg6 = 1.531383769920937332e-01,
+        Lg7 = 1.479819860511658591e-01;
+    __math_dbl_t u = { x };
+    double hfsq, f, s, z, R, w, t1, t2;
+    uint32_t hx = u.i >> 32;
+
+    *k = 0; *special = 1;
+    if(hx < 0x00100000 || hx >> 31) {
+        if(u.i << 1 == 0) return -1 / (x * x);  /* log(+-0) = -inf */
+        if(hx >> 31) return (x - x) / 0.0;      /* log(-#) = nan */
+        /* subnormal number, scale x up */
+        *k -= 54;
+        x *= 0x1p54;
+        u.f = x;
+        hx = u.i >> 32;
+    } else if(hx >= 0x7ff00000)
+        return x;
+    *special = 0;
+    hx += 0x3ff00000 - 0x3fe6a09e;
+    *k += (int)(hx >> 20) - 0x3ff;
+    hx = (hx & 0x000fffff) + 0x3fe6a09e;
+    u.i = (uint64_t)hx << 32 | (u.i & 0xffffffff);
+    f = u.f - 1.0;
+    hfsq = 0.5 * f * f;
+    s = f / (2.0 + f);
+    z = s * s;
+    w = z * z;
+    t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+    t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+    R = t2 + t1;
+    return s * (hfsq + R) - hfsq + f;
+}
+
+double log(double __x)
+{
+    int k, special;
+    double r = __log_r(__x, &k, &special);
+    /* add the exponent part in two steps to keep precision */
+    return special ? r : (r + k * ln2_lo) + k * ln2_hi;
+}
+
+double log2(double __x)
+{
+    int k, special;
+    double r = __log_r(__x, &k, &special);
+    return special ? r : r * invln2 + k;
+}
+
+double log10(double __x)
+{
+    static const double
+        ivln10    = 4.34294481903251816668e-01,
+        log10_2hi = 3.01029995663611771306e-01,
+        log10_2lo = 3.69423907715893078616e-13;
+    int k, special;
+    double r = __log_r(__x, &k, &special);
+    return special ? r : (r * ivln10 + k * log10_2lo) + k * log10_2hi;
+}
+
+double pow(double __x, double __y)
+{
+    static const double
+        bp[]   = { 1.0, 1.5 },
+        dp_h[] = { 0.0, 5.84962487220764160156e-01 },   /* 0x3fe2b803 40000000 */
+        dp_l[] = { 0.0, 1.35003920212974897128e-08 },   /* 0x3e4cfdeb 43cfd006 */
+        two53  =  9007199254740992.0,
+        huge   =  1.0e300,
+        tiny   =  1.0e-300,
+        /* poly coefs for (3/2)*(log(x)-2s-2/3*s**3 */
+        L1 =  5.99999999999994648725e-01,
+        L2 =  4.28571428578550184252e-01,
+        L3 =  3.33333329818377432918e-01,
+        L4 =  2.72728123808534006489e-01,
+        L5 =  2.30660745775561754067e-01,
+        L6 =  2.06975017800338417784e-01,
+        P1 =  1.66666666666666019037e-01,
+        P2 = -2.77777777770155933842e-03,
+        P3 =  6.61375632143793436117e-05,
+        P4 = -1.65339022054652515390e-06,
+        P5 =  4.13813679705723846039e-08,
+        lg2   =  6.93147180559945286227e-01,
+        lg2_h =  6.93147182464599609375e-01,
+        lg2_l = -1.90465429995776804525e-09,
+        ovt   =  8.0085662595372944372e-17,         /* -(1024-log2(ovfl+.5ulp)) */
+        cp    =  9.61796693925975554329e-01,        /* 2/(3ln2) */
+        cp_h  =  9.61796700954437255859e-01,        /* (float)cp */
+        cp_l  = -7.02846165095275826516e-09,        /* tail of cp_h */
+        ivln2_h = 1.44269502162933349609e+00,       /* 24b 1/ln2 */
+        ivln2_l = 1.92596299112661746887e-08;       /* 1/ln2 tail */
+    double z, ax, z_h, z_l, p_h, p_l, y1, t1, t2, r, s, t, u, v, w, ss, s2, s_h, s_l, t_h, t_l;
+    int32_t i, j, k, yisint, n, hx, hy, ix, iy;
+    uint32_t lx, ly;
+    __math_dbl_t c;
+
+    hx = (int32_t)HIWORD(__x); lx = LOWORD(__x);
+    hy = (int32_t)HIWORD(__y); ly = LOWORD(__y);
+    ix = hx & 0x7fffffff;
+    iy = hy & 0x7fffffff;
+
+    /* x**0 = 1, even if x is nan, 1**y = 1, even if y is nan */
+    if((iy | ly) == 0 || (hx == 0x3ff00000 && lx == 0)) return 1.0;
+    /* nan if either argument is nan */
+    if(ix > 0x7ff00000 || (ix == 0x7ff00000 && lx != 0) || iy > 0x7ff00000 || (iy == 0x7ff00000 && ly != 0))
+        return __x + __y;
+    /* determine if y is an odd int when x < 0: yisint = 0 not an integer, 1 odd, 2 even */
+    yisint = 0;
+    if(hx < 0) {
+        if(iy >= 0x43400000) yisint = 2;        /* even integer y */
+        else if(iy >= 0x3ff00000) {
+            k = (iy >> 20) - 0x3ff;
+            if(k > 20) {
+                j = (int32_t)(ly >> (52 - k));
+                if(((uint32_t)j << (52 - k)) == ly) yisint = 2 - (j & 1);
+            } else if(ly == 0) {
+                j = iy >> (20 - k);
+                if((j << (20 - k)) == iy) yisint = 2 - (j & 1);
+            }
+        }
+    }
+    /* special value of y */
+    if(ly == 0) {
+        if(iy == 0x7ff00000) {                  /* y is +-inf */
+            if(((ix - 0x3ff00000) | lx) == 0) return 1.0;   /* (-1)**+-inf is 1 */
+            else if(ix >= 0x3ff00000) return hy >= 0 ? __y : 0.0;
+            else return hy >= 0 ? 0.0 : -__y;
+        }
+        if(iy == 0x3ff00000) return hy >= 0 ? __x : 1.0 / __x;
+        if(hy == 0x40000000) return __x * __x;
+        if(hy == 0x3fe00000 && hx >= 0) return sqrt(__x);
+    }
+    ax = fabs(__x);
+    /* special value of x */
+    if(lx == 0 && (ix == 0x7ff00000 || ix == 0 || ix == 0x3ff00000)) {
+        z = ax;
+        if(hy < 0) z = 1.0 / z;
+        if(hx < 0) {
+            if(((ix - 0x3ff00000) | yisint) == 0) z = (z - z) / (z - z);  /* (-1)**non-int is nan */
+            else if(yisint == 1) z = -z;
+        }
+        return z;
+    }
+    s = 1.0;
+    if(hx < 0) {
+        if(yisint == 0) return (__x - __x) / (__x - __x);
+        if(yisint == 1) s = -1.0;
+    }
+    /* |y| is huge */
+    if(iy > 0x41e00000) {                       /* if |y| > 2**31 */
+        if(iy > 0x43f00000) {                   /* if |y| > 2**64, must o/uflow */
+            if(ix <= 0x3fefffff) return hy < 0 ? huge * huge : tiny * tiny;
+            if(ix >= 0x3ff00000) return hy > 0 ? huge * huge : tiny * tiny;
+        }
+        /* over/underflow if x is not close to one */
+        if(ix < 0x3fefffff) return hy < 0 ? s * huge * huge : s * tiny * tiny;
+        if(ix > 0x3ff00000) return hy > 0 ? s * huge * huge : s * tiny * tiny;
+        /* now |1-x| is tiny <= 2**-20, suffice to compute log(x) by x-x^2/2+x^3/3-x^4/4 */
+        t = ax - 1.0;
+        w = (t * t) * (0.5 - t * (0.3333333333333333333333 - t * 0.25));
+        u = ivln2_h * t;
+        v = t * ivln2_l - w * invln2;
+        t1 = u + v;
+        c.f = t1; c.i &= 0xffffffff00000000ULL; t1 = c.f;
+        t2 = v - (t1 - u);
+    } else {
+        n = 0;
+        /* take care subnormal number */
+        if(ix < 0x00100000) {
+            ax *= two53;
+            n -= 53;
+            ix = (int32_t)HIWORD(ax);
+        }
+        n += ((ix) >> 20) - 0x3ff;
+        j = ix & 0x000fffff;
+        /* determine interval */
+        ix = j | 0x3ff00000;
+        if(j <= 0x3988E) k = 0;                 /* |x| < sqrt(3/2) */
+        else if(j < 0xBB67A) k = 1;             /* |x| < sqrt(3) */
+        else {
+            k = 0;
+            n += 1;
+            ix -= 0x00100000;
+        }
+        c.f = ax; c.i = ((uint64_t)(uint32_t)ix << 32) | (c.i & 0xffffffff); ax = c.f;
+        /* compute ss = s_h+s_l = (x-1)/(x+1) or (x-1.5)/(x+1.5) */
+        u = ax - bp[k];
+        v = 1.0 / (ax + bp[k]);
+        ss = u * v;
+        s_h = ss;
+        c.f = s_h; c.i &= 0xffffffff00000000ULL; s_h = c.f;
+        /* t_h = ax + bp[k] high */
+        c.i = (uint64_t)(uint32_t)(((ix >> 1) | 0x20000000) + 0x00080000 + (k << 18)) << 32; t_h = c.f;
+        t_l = ax - (t_h - bp[k]);
+        s_l = v * ((u - s_h * t_h) - s_h * t_l);
+        /* compute log(ax) */
+        s2 = ss * ss;
+        r = s2 * s2 * (L1 + s2 * (L2 + s2 * (L3 + s2 * (L4 + s2 * (L5 + s2 * L6)))));
+        r += s_l * (s_h + ss);
+        s2 = s_h * s_h;
+        t_h = 3.0 + s2 + r;
+        c.f = t_h; c.i &= 0xffffffff00000000ULL; t_h = c.f;
+        t_l = r - ((t_h - 3.0) - s2);
+        /* u+v = ss*(1+...) */
+        u = s_h * t_h;
+        v = s_l * t_h + t_l * ss;
+        /* 2/(3log2)*(ss+...) */
+        p_h = u + v;
+        c.f = p_h; c.i &= 0xffffffff00000000ULL; p_h = c.f;
+        p_l = v - (p_h - u);
+        z_h = cp_h * p_h;
+        z_l = cp_l * p_h + p_l * cp + dp_l[k];
+        /* log2(ax) = (ss+..)*2/(3*log2) = n + dp_h + z_h + z_l */
+        t = (double)n;
+        t1 = ((z_h + z_l) + dp_h[k]) + t;
+        c.f = t1; c.i &= 0xffffffff00000000ULL; t1 = c.f;
+        t2 = z_l - (((t1 - t) - dp_h[k]) - z_h);
+    }
+    /* split up y into y1+y2 and compute (y1+y2)*(t1+t2) */
+    c.f = __y; c.i &= 0xffffffff00000000ULL; y1 = c.f;
+    p_l = (__y - y1) * t1 + __y * t2;
+    p_h = y1 * t1;
+    z = p_l + p_h;
+    j = (int32_t)HIWORD(z);
+    i = (int32_t)LOWORD(z);
+    if(j >= 0x40900000) {                       /* z >= 1024 */
+        if(((j - 0x40900000) | i) != 0) return s * huge * huge;
+        if(p_l + ovt > z - p_h) return s * huge * huge;
+    } else if((j & 0x7fffffff) >= 0x4090cc00) { /* z <= -1075 */
+        if((((uint32_t)j - 0xc090cc00) | (uint32_t)i) != 0) return s * tiny * tiny;
+        if(p_l <= z - p_h) return s * tiny * tiny;
+    }
+    /* compute 2**(p_h+p_l) */
+    i = j & 0x7fffffff;
+    k = (i >> 20) - 0x3ff;
+    n = 0;
+    if(i > 0x3fe00000) {                        /* if |z| > 0.5, set n = [z+0.5] */
+        n = j + (0x00100000 >> (k + 1));
+        k = ((n & 0x7fffffff) >> 20) - 0x3ff;   /* new k for n */
+        c.i = (uint64_t)(uint32_t)(n & ~(0x000fffff >> k)) << 32; t = c.f;
+        n = ((n & 0x000fffff) | 0x00100000) >> (20 - k);
+        if(j < 0) n = -n;
+        p_h -= t;
+    }
+    t = p_l + p_h;
+    c.f = t; c.i &= 0xffffffff00000000ULL; t = c.f;
+    u = t * lg2_h;
+    v = (p_l - (t - p_h)) * lg2 + t * lg2_l;
+    z = u + v;
+    w = v - (z - u);
+    t = z * z;
+    t1 = z - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+    r = (z * t1) / (t1 - 2.0) - (w + z * w);
+    z = 1.0 - (r - z);
+    j = (int32_t)HIWORD(z);
+    j += n << 20;
+    if((j >> 20) <= 0) z = ldexp(z, n);         /* subnormal output */
+    else { c.f = z; c.i = ((uint64_t)(uint32_t)j << 32) | (c.i & 0xffffffff); z = c.f; }
+    return s * z;
+}
+
+/* Payne-Hanek reduction for huge arguments, x is |x| split into nx 24 bit pieces, x[0] * 2^e0 is the most significant.
+ * Multiplies with as many bits of 2/pi as needed, returns the low 3 bits of the quadrant and y[0] + y[1] = remainder */
+static int __rem_pio2_large(double *x, double *y, int e0, int nx)
+{
+    /* 2/pi in 24 bit pieces, enough for any double */
+    static const int32_t ipio2[] = {
+        0xA2F983, 0x6E4E44, 0x1529FC, 0x2757D1, 0xF534DD, 0xC0DB62,
+        0x95993C, 0x439041, 0xFE5163, 0xABDEBB, 0xC561B7, 0x246E3A,
+        0x424DD2, 0xE00649, 0x2EEA09, 0xD1921C, 0xFE1DEB, 0x1CB129,
+        0xA73EE8, 0x8235F5, 0x2EBB44, 0x84E99C, 0x7026B4, 0x5F7E41,
+        0x3991D6, 0x398353, 0x39F49C, 0x845F8B, 0xBDF928, 0x3B1FF8,
+        0x97FFDE, 0x05980F, 0xEF2F11, 0x8B5A0A, 0x6D1F6D, 0x367ECF,
+        0x27CB09, 0xB74F46, 0x3F669E, 0x5FEA2D, 0x7527BA, 0xC7EBE5,
+        0xF17B3D, 0x0739F7, 0x8A5292, 0xEA6BFB, 0x5FB11F, 0x8D5D08,
+        0x560330, 0x46FC7B, 0x6BABF0, 0xCFBC20, 0x9AF436, 0x1DA9E3,
+        0x91615E, 0xE61B08, 0x659985, 0x5F14A0, 0x68408D, 0xFFD880,
+        0x4D7327, 0x310606, 0x1556CA, 0x73A8C9, 0x60E27B, 0xC08C6B
+    };
+    /* pi/2 in 24 bit pieces */
+    static const double PIo2[] = {
+        1.57079625129699707031e+00,         /* 3ff921fb 40000000 */
+        7.54978941586159635335e-08,         /* 3e74442d 00000000 */
+        5.39030252995776476554e-15,         /* 3cf84698 80000000 */
+        3.28200341580791294123e-22,         /* 3b78cc51 60000000 */
+        1.27065575308067607349e-29,         /* 39f01b83 80000000 */
+        1.22933308981111328932e-36,         /* 387a2520 40000000 */
+        2.73370053816464559624e-44,         /* 36e38222 80000000 */
+        2.16741683877804819444e-51          /* 3569f31d 00000000 */
+    };
+    int32_t jz, jx, jv, jk = 4, carry, n, iq[20], i, j, k, m, q0, ih;
+    double z, fw, f[20], fq[20], q[20];
+
+    jx = nx - 1;
+    jv = (e0 - 3) / 24;
+    if(jv < 0) jv = 0;
+    q0 = e0 - 24 * (jv + 1);
+    /* f[0] to f[jx+jk] are the pieces of 2/pi that matter, the ones before only make multiples of 2pi */
+    for(i = 0, j = jv - jx, m = jx + jk; i <= m; i++, j++)
+        f[i] = j < 0 ? 0.0 : (double)ipio2[j];
+    for(i = 0; i <= jk; i++) {
+        for(j = 0, fw = 0.0; j <= jx; j++)
+            fw += x[j] * f[jx + i - j];
+        q[i] = fw;
+    }
+    jz = jk;
+recompute:
+    /* distill q[] into 24 bit integers in iq[], in reverse order */
+    for(i = 0, j = jz, z = q[jz]; j > 0; i++, j--) {
+        fw = (double)(int32_t)(0x1p-24 * z);
+        iq[i] = (int32_t)(z - 0x1p24 * fw);
+        z = q[j - 1] + fw;
+    }
+    /* the integer part gives the quadrant */
+    z = ldexp(z, q0);
+    z -= 8.0 * floor(z * 0.125);
+    n = (int32_t)z;
+    z -= (double)n;
+    ih = 0;
+    if(q0 > 0) {
+        i = iq[jz - 1] >> (24 - q0);
+        n += i;
+        iq[jz - 1] -= i << (24 - q0);
+        ih = iq[jz - 1] >> (23 - q0);
+    } else if(q0 == 0) ih = iq[jz - 1] >> 23;
+    else if(z >= 0.5) ih = 2;
+    if(ih > 0) {
+        /* the fraction is over 0.5, take the next quadrant and 1 - fraction */
+        n += 1;
+        for(i = carry = 0; i < jz; i++) {
+            j = iq[i];
+            if(!carry) {
+                if(j) { carry = 1; iq[i] = 0x1000000 - j; }
+            } else
+                iq[i] = 0xffffff - j;
+        }
+        if(q0 == 1) iq[jz - 1] &= 0x7fffff;
+        if(q0 == 2) iq[jz - 1] &= 0x3fffff;
+        if(ih == 2) {
+            z = 1.0 - z;
+            if(carry) z -= ldexp(1.0, q0);
+        }
+    }
+    /* all bits cancelled out, the argument is very close to a multiple of pi/2, so more bits of 2/pi are needed */
+    if(z == 0.0) {
+        for(i = jz - 1, j = 0; i >= jk; i--) j |= iq[i];
+        if(!j) {
+            for(k = 1; !iq[jk - k]; k++);
+            for(i = jz + 1; i <= jz + k; i++) {
+                f[jx + i] = (double)ipio2[jv + i];
+                for(j = 0, fw = 0.0; j <= jx; j++)
+                    fw += x[j] * f[jx + i - j];
+                q[i] = fw;
+            }
+            jz += k;
+            goto recompute;
+        }
+    }
+    /* chop off zero pieces, or break z into 24 bit pieces */
+    if(z == 0.0) {
+        jz--;
+        q0 -= 24;
+        while(!iq[jz]) { jz--; q0 -= 24; }
+    } else {
+        z = ldexp(z, -q0);
+        if(z >= 0x1p24) {
+            fw = (double)(int32_t)(0x1p-24 * z);
+            iq[jz] = (int32_t)(z - 0x1p24 * fw);
+            jz++;
+            q0 += 24;
+            iq[jz] = (int32_t)fw;
+        } else
+            iq[jz] = (int32_t)z;
+    }
+    /* the fraction times pi/2 */
+    for(i = jz, fw = ldexp(1.0, q0); i >= 0; i--, fw *= 0x1p-24)
+        q[i] = fw * (double)iq[i];
+    fq[0] = 0.0;                                /* always set below, but the compiler can't tell */
+    for(i = jz; i >= 0; i--) {
+        for(fw = 0.0, k = 0; k <= jk && k <= jz - i; k++)
+            fw += PIo2[k] * q[i + k];
+        fq[jz - i] = fw;
+    }
+    for(i = jz, fw = 0.0; i >= 0; i--)
+        fw += fq[i];
+    y[0] = ih ? -fw : fw;
+    fw = fq[0] - fw;
+    for(i = 1; i <= jz; i++)
+        fw += fq[i];
+    y[1] = ih ? -fw : fw;
+    return n & 7;
+}
+
+/* reduce x into [-pi/4, pi/4], returns the quadrant. Cody-Waite with 3 parts of pi/2 for |x| < 2**20*pi/2, where the
+ * quadrant fits into the 53 bits of pi/2's first part, Payne-Hanek above that */
+static int __rem_pio2(double x, double *y)
+{
+    static const double
+        toint   = 1.5 / 2.22044604925031308085e-16,
+        invpio2 = 6.36619772367581382433e-01,
+        pio2_1  = 1.57079632673412561417e+00,
+        pio2_1t = 6.07710050650619224932e-11,
+        pio2_2  = 6.07710050630396597660e-11,
+        pio2_2t = 2.02226624879595063154e-21,
+        pio2_3  = 2.02226624871116645580e-21,
+        pio2_3t = 8.47842766036889956997e-32;
+    __math_dbl_t u;
+    double fn, r, w, t, z, tx[3];
+    int n, ex, ey, i;
+
+    ex = (HIWORD(x) >> 20) & 0x7ff;
+    if(ex < 0x3fe - 0) {
+        /* |x| < 0.5, nothing to do */
+        y[0] = x; y[1] = 0;
+        return 0;
+    }
+    if((HIWORD(x) & 0x7fffffff) >= 0x413921fb) {
+        /* split |x| into three 24 bit pieces, scaled so that the first one is an integer */
+        u.f = x;
+        u.i &= -1ULL >> 12;
+        u.i |= (uint64_t)(0x3ff + 23) << 52;
+        z = u.f;
+        for(i = 0; i < 2; i++) {
+            tx[i] = (double)(int32_t)z;
+            z = (z - tx[i]) * 0x1p24;
+        }
+        tx[i] = z;
+        while(tx[i] == 0.0) i--;
+        n = __rem_pio2_large(tx, y, ex - (0x3ff + 23), i + 1);
+        if(x < 0) { y[0] = -y[0]; y[1] = -y[1]; n = -n; }
+        return n;
+    }
+    fn = x * invpio2 + toint - toint;
+    n = (int)fn;
+    r = x - fn * pio2_1;
+    w = fn * pio2_1t;
+    y[0] = r - w;
+    ey = (HIWORD(y[0]) >> 20) & 0x7ff;
+    if(ex - ey > 16) {
+        /* 2nd iteration needed, good to 118 bits */
+        t = r;
+        w = fn * pio2_2;
+        r = t - w;
+        w = fn * pio2_2t - ((t - r) - w);
+        y[0] = r - w;
+        ey = (HIWORD(y[0]) >> 20) & 0x7ff;
+        if(ex - ey > 49) {
+            /* 3rd iteration, 151 bits */
+            t = r;
+            w = fn * pio2_3;
+            r = t - w;
+            w = fn * pio2_3t - ((t - r) - w);
+            y[0] = r - w;
+        }
+    }
+    y[1] = (r - y[0]) - w;
+    return n;
+}
+
+/* kernels on [-pi/4, pi/4], y is the tail of x */
+static double __sin(double x, double y, int iy)
+{
+    static const double
+        S1 = -1.66666666666666324348e-01,
+        S2 =  8.33333333332248946124e-03,
+        S3 = -1.98412698298579493134e-04,
+        S4 =  2.75573137070700676789e-06,
+        S5 = -2.50507602534068634195e-08,
+        S6 =  1.58969099521155010221e-10;
+    double z = x * x, w = z * z, r, v;
+    r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+    v = z * x;
+    if(!iy) return x + v * (S1 + z * r);
+    return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+}
+
+static double __cos(double x, double y)
+{
+    static const double
+        C1 =  4.16666666666666019037e-02,
+        C2 = -1.38888888888741095749e-03,
+        C3 =  2.48015872894767294178e-05,
+        C4 = -2.75573143513906633035e-07,
+        C5 =  2.08757232129817482790e-09,
+        C6 = -1.13596475577881948265e-11;
+    double z = x * x, w = z * z, r, hz;
+    r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+    hz = 0.5 * z;
+    w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + (z * r - x * y));
+}
+
+/* tan on [-pi/4, pi/4], -1/tan if odd. Above 0.67 it uses tan(pi/4 - x) = (1 - tan(x)) / (1 + tan(x)) */
+static double __tan(double x, double y, int odd)
+{
+    static const double
+        T[] = {
+            3.33333333333334091986e-01,     /* 3fd55555 55555563 */
+            1.33333333333201242699e-01,     /* 3fc11111 1110fe7a */
+            5.39682539762260521377e-02,     /* 3faba1ba 1bb341fe */
+            2.18694882948595424599e-02,     /* 3f9664f4 8406d637 */
+            8.86323982359930005737e-03,     /* 3f8226e3 e96e8493 */
+            3.59207910759131235356e-03,     /* 3f6d6d22 c9560328 */
+            1.45620945432529025516e-03,     /* 3f57dbc8 fee08315 */
+            5.88041240820264096874e-04,     /* 3f4344d8 f2f26501 */
+            2.46463134818469906812e-04,     /* 3f3026f7 1a8d1068 */
+            7.81794442939557092300e-05,     /* 3f147e88 a03792a6 */
+            7.14072491382608190305e-05,     /* 3f12b80f 32f0a7e9 */
+           -1.85586374855275456654e-05,     /* bef375cb db605373 */
+            2.59073051863633712884e-05      /* 3efb2a70 74bf7ad4 */
+        },
+        pio4   = 7.85398163397448278999e-01,    /* 3fe921fb 54442d18 */
+        pio4lo = 3.06161699786838301793e-17;    /* 3c81a626 33145c07 */
+    __math_dbl_t u;
+    double z, r, v, w, s, a, w0, a0;
+    int big, sign = 0;
+
+    big = (HIWORD(x) & 0x7fffffff) >= 0x3fe59428;
+    if(big) {
+        sign = x < 0;
+        if(sign) { x = -x; y = -y; }
+        x = (pio4 - x) + (pio4lo - y);
+        y = 0.0;
+    }
+    z = x * x;
+    w = z * z;
+    r = T[1] + w * (T[3] + w * (T[5] + w * (T[7] + w * (T[9] + w * T[11]))));
+    v = z * (T[2] + w * (T[4] + w * (T[6] + w * (T[8] + w * (T[10] + w * T[12])))));
+    s = z * x;
+    r = y + z * (s * (r + v) + y) + s * T[0];
+    w = x + r;
+    if(big) {
+        s = 1 - 2 * odd;
+        v = s - 2.0 * (x + (r - w * w / (w + s)));
+        return sign ? -v : v;
+    }
+    if(!odd) return w;
+    /* -1/(x+r) would have 2 ulp error, so it's calculated from parts with the low words cleared */
+    u.f = w; u.i &= 0xffffffff00000000ULL; w0 = u.f;
+    v = r - (w0 - x);
+    a = -1.0 / w;
+    u.f = a; u.i &= 0xffffffff00000000ULL; a0 = u.f;
+    return a0 + a * (1.0 + a0 * w0 + a0 * v);
+}
+
+double sin(double __x)
+{
+    double y[2];
+    int n;
+    if(__x != __x || fabs(__x) == 1.0 / 0.0) return __x - __x;
+    if(fabs(__x) < 0x1p-26) return __x;
+    n = __rem_pio2(__x, y);
+    switch(n & 3) {
+        case 0: return  __sin(y[0], y[1], 1);
+        case 1: return  __cos(y[0], y[1]);
+        case 2: return -__sin(y[0], y[1], 1);
+        default: return -__cos(y[0], y[1]);
+    }
+}
+
+double cos(double __x)
+{
+    double y[2];
+    int n;
+    if(__x != __x || fabs(__x) == 1.0 / 0.0) return __x - __x;
+    if(fabs(__x) < 0x1p-27) return 1.0;
+    n = __rem_pio2(__x, y);
+    switch(n & 3) {
+        case 0: return  __cos(y[0], y[1]);
+        case 1: return -__sin(y[0], y[1], 1);
+        case 2: return -__cos(y[0], y[1]);
+        default: return  __sin(y[0], y[1], 1);
+    }
+}
+
+double tan(double __x)
+{
+    double y[2];
+    int n;
+    if(__x != __x || fabs(__x) == 1.0 / 0.0) return __x - __x;
+    if(fabs(__x) < 0x1p-27) return __x;
+    n = __rem_pio2(__x, y);
+    return __tan(y[0], y[1], n & 1);
+}
+
+double atan(double __x)
+{
+    static const double
+        atanhi[] = {
+            4.63647609000806093515e-01,     /* atan(0.5)hi */
+            7.85398163397448278999e-01,     /* atan(1.0)hi */
+            9.82793723247329054082e-01,     /* atan(1.5)hi */
+            1.57079632679489655800e+00 },   /* atan(inf)hi */
+        atanlo[] = {
+            2.26987774529616870924e-17,
+            3.06161699786838301793e-17,
+            1.39033110312309984516e-17,
+            6.12323399573676603587e-17 },
+        aT[] = {
+             3.33333333333329318027e-01,
+            -1.99999999998764832476e-01,
+             1.42857142725034663711e-01,
+            -1.11111104054623557880e-01,
+             9.09088713343650656196e-02,
+            -7.69187620504482999495e-02,
+             6.66107313738753120669e-02,
+            -5.83357013379057348645e-02,
+             4.97687799461593236017e-02,
+            -3.65315727442169155270e-02,
+             1.62858201153657823623e-02 };
+    double w, s1, s2, z;
+    uint32_t ix = HIWORD(__x), sign = ix >> 31;
+    int id;
+
+    ix &= 0x7fffffff;
+    if(ix >= 0x44100000) {                      /* if |x| >= 2^66 */
+        if(__x != __x) return __x;
+        z = atanhi[3] + 0x1p-120;
+        return sign ? -z : z;
+    }
+    if(ix < 0x3fdc0000) {                       /* |x| < 0.4375 */
+        if(ix < 0x3e400000) return __x;         /* |x| < 2^-27 */
+        id = -1;
+    } else {
+        __x = fabs(__x);
+        if(ix < 0x3ff30000) {                   /* |x| < 1.1875 */
+            if(ix < 0x3fe60000) {               /* 7/16 <= |x| < 11/16 */
+                id = 0;
+                __x = (2.0 * __x - 1.0) / (2.0 + __x);
+            } else {                            /* 11/16 <= |x| < 19/16 */
+                id = 1;
+                __x = (__x - 1.0) / (__x + 1.0);
+            }
+        } else {
+            if(ix < 0x40038000) {               /* |x| < 2.4375 */
+                id = 2;
+                __x = (__x - 1.5) / (1.0 + 1.5 * __x);
+            } else {                            /* 2.4375 <= |x| < 2^66 */
+                id = 3;
+                __x = -1.0 / __x;
+            }
+        }
+    }
+    z = __x * __x;
+    w = z * z;
+    s1 = z * (aT[0] + w * (aT[2] + w * (aT[4] + w * (aT[6] + w * (aT[8] + w * aT[10])))));
+    s2 = w * (aT[1] + w * (aT[3] + w * (aT[5] + w * (aT[7] + w * aT[9]))));
+    if(id < 0) return __x - __x * (s1 + s2);
+    z = atanhi[id] - (__x * (s1 + s2) - atanlo[id] - __x);
+    return sign ? -z : z;
+}
+
+double atan2(double __y, double __x)
+{
+    double z;
+    uint32_t m, lx, ly, ix, iy;
+
+    if(__x != __x || __y != __y) return __x + __y;
+    ix = HIWORD(__x); lx = LOWORD(__x);
+    iy = HIWORD(__y); ly = LOWORD(__y);
+    if(((ix - 0x3ff00000) | lx) == 0) return atan(__y);     /* x = 1.0 */
+    m = ((iy >> 31) & 1) | ((ix >> 30) & 2);                /* 2*sign(x)+sign(y) */
+    ix &= 0x7fffffff;
+    iy &= 0x7fffffff;
+    /* when y = 0 */
+    if((iy | ly) == 0) {
+        switch(m) {
+            case 0: case 1: return __y;                     /* atan(+-0,+anything)=+-0 */
+            case 2: return pi;                              /* atan(+0,-anything) = pi */
+            default: return -pi;                            /* atan(-0,-anything) =-pi */
+        }
+    }
+    /* when x = 0 */
+    if((ix | lx) == 0) return m & 1 ? -pi / 2 : pi / 2;
+    /* when x is inf */
+    if(ix == 0x7ff00000) {
+        if(iy == 0x7ff00000) {
+            switch(m) {
+                case 0: return pi / 4;
+                case 1: return -pi / 4;
+                case 2: return 3 * pi / 4;
+                default: return -3 * pi / 4;
+            }
+        } else {
+            switch(m) {
+                case 0: return 0.0;
+                case 1: return -0.0;
+                case 2: return pi;
+                default: return -pi;
+            }
+        }
+    }
+    /* |y/x| > 0x1p64 */
+    if(ix + (64 << 20) < iy || iy == 0x7ff00000) return m & 1 ? -pi / 2 : pi / 2;
+    /* z = atan(|y/x|) without spurious underflow */
+    if((m & 2) && iy + (64 << 20) < ix) z = 0;             /* |y/x| < 0x1p-64, x<0 */
+    else z = atan(fabs(__y / __x));
+    switch(m) {
+        case 0: return z;                                   /* atan(+,+) */
+        case 1: return -z;                                  /* atan(-,+) */
+        case 2: return pi - (z - pi_lo);                    /* atan(+,-) */
+        default: return (z - pi_lo) - pi;                   /* atan(-,-) */
+    }
+}
+
+double asin(double __x)
+{
+    if(fabs(__x) > 1.0) return (__x - __x) / (__x - __x);
+    return atan2(__x, sqrt((1.0 - __x) * (1.0 + __x)));
+}
+
+double acos(double __x)
+{
+    if(fabs(__x) > 1.0) return (__x - __x) / (__x - __x);
+    return atan2(sqrt((1.0 - __x) * (1.0 + __x)), __x);
+}
+
+/* single precision variants. Where there's no exact bit trick or instruction, these are computed in double
+ * precision, which makes them correctly rounded in all but a very few cases */
+float fabsf(float __x)
+{
+    __math_flt_t u = { __x };
+    u.i &= 0x7fffffff;
+    return u.f;
+}
+
+float sqrtf(float __x)
+{
+#if defined(__x86_64__)
+    __asm__("sqrtss %1, %0" : "=x"(__x) : "x"(__x));
+#elif defined(__aarch64__)
+    __asm__("fsqrt %s0, %s1" : "=w"(__x) : "w"(__x));
+#elif defined(__riscv)
+    __asm__("fsqrt.s %0, %1" : "=f"(__x) : "f"(__x));
+#else
+    __x = (float)sqrt(__x);
+#endif
+    return __x;
+}
+
+float floorf(float __x) { return (float)floor(__x); }
+float ceilf(float __x) { return (float)ceil(__x); }
+float truncf(float __x) { return (float)trunc(__x); }
+float roundf(float __x) { return (float)round(__x); }
+float fmodf(float __x, float __y) { return (float)fmod(__x, __y); }
+float sinf(float __x) { return (float)sin(__x); }
+float cosf(float __x) { return (float)cos(__x); }
+float tanf(float __x) { return (float)tan(__x); }
+float atanf(float __x) { return (float)atan(__x); }
+float atan2f(float __y, float __x) { return (float)atan2(__y, __x); }
+float expf(float __x) { return (float)exp(__x); }
+float logf(float __x) { return (float)log(__x); }
+float log2f(float __x) { return (float)log2(__x); }
+float powf(float __x, float __y) { return (float)pow(__x, __y); }
+
+/* batched variants, 4 floats at once with the compiler's vector extension, which translates to SSE2 on x86_64 and
+ * NEON on aarch64. Lanes which are out of the vectorized code's range are passed to the scalar functions instead. Where
+ * float precision isn't enough (argument reduction for sin and cos, log and exp in pow), lanes are widened to double */
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef float v4sf_u __attribute__((vector_size(16), aligned(4), may_alias));
+typedef double v4df __attribute__((vector_size(32)));
+typedef int64_t v4di __attribute__((vector_size(32)));
+#define V4(a)           ((v4sf){ a, a, a, a })
+#define V4I(a)          ((v4si){ a, a, a, a })
+#define V4D(a)          ((v4df){ a, a, a, a })
+#define V4L(a)          ((v4di){ a, a, a, a })
+#define VSEL(m,a,b)     ((v4sf)(((m) & (v4si)(a)) | (~(m) & (v4si)(b))))
+#define VSELD(m,a,b)    ((v4df)(((m) & (v4di)(a)) | (~(m) & (v4di)(b))))
+#define VANY(m)         ((m)[0] | (m)[1] | (m)[2] | (m)[3])
+/* round doubles to nearest integer, valid for |x| < 2^51. Functions don't take or return v4df, because that would need
+ * the AVX calling convention */
+#define VRINTD(x)       (((x) + V4D(6755399441055744.0)) - V4D(6755399441055744.0))
+
+/* round to nearest integer, only valid for |x| < 2^22 */
+static inline v4sf __vrint(v4sf x)
+{
+    return (x + V4(12582912.0f)) - V4(12582912.0f);
+}
+
+/* 2^n * poly(r), valid for x in [-87, 88] */
+static inline v4sf __vexpf(v4sf x)
+{
+    v4sf n, r, p;
+    n = __vrint(x * V4(1.44269504088896341f));
+    r = x - n * V4(0.693359375f) - n * V4(-2.12194440e-4f);
+    p = V4(1.9875691500E-4f);
+    p = p * r + V4(1.3981999507E-3f);
+    p = p * r + V4(8.3334519073E-3f);
+    p = p * r + V4(4.1665795894E-2f);
+    p = p * r + V4(1.6666665459E-1f);
+    p = p * r + V4(5.0000001201E-1f);
+    p = p * r * r + r + V4(1.0f);
+    return p * (v4sf)((__builtin_convertvector(n, v4si) + V4I(127)) << 23);
+}
+
+/* valid for normal positive numbers */
+static inline v4sf __vlogf(v4sf x)
+{
+    v4si i = (v4si)x, big;
+    v4sf e, m, s, z, p;
+    e = __builtin_convertvector(((i >> 23) & V4I(0xff)) - V4I(127), v4sf);
+    m = (v4sf)((i & V4I(0x7fffff)) | V4I(0x3f800000));
+    /* bring m into [sqrt(2)/2, sqrt(2)] */
+    big = m > V4(1.41421356f);
+    m = VSEL(big, m * V4(0.5f), m);
+    e = VSEL(big, e + V4(1.0f), e);
+    /* log(m) = 2 atanh(s) */
+    s = (m - V4(1.0f)) / (m + V4(1.0f));
+    z = s * s;
+    p = V4(2.0f / 9.0f);
+    p = p * z + V4(2.0f / 7.0f);
+    p = p * z + V4(2.0f / 5.0f);
+    p = p * z + V4(2.0f / 3.0f);
+    p = s * z * p + s * V4(2.0f);
+    return e * V4(0.693359375f) + (p + e * V4(-2.12194440e-4f));
+}
+
+/* x^y = exp(y * log(x)) in double precision, valid for normal positive x. Returns 0 if y * log(x) is out of [-87, 88] */
+static inline int __vpowf(v4sf x, float y, v4sf *r)
+{
+    v4si i = (v4si)x, big;
+    v4sf e, m;
+    v4df s, z, p, l, n;
+    /* log(x) = e * ln2 + 2 atanh(s) */
+    e = __builtin_convertvector(((i >> 23) & V4I(0xff)) - V4I(127), v4sf);
+    m = (v4sf)((i & V4I(0x7fffff)) | V4I(0x3f800000));
+    big = m > V4(1.41421356f);
+    m = VSEL(big, m * V4(0.5f), m);
+    e = VSEL(big, e + V4(1.0f), e);
+    s = (__builtin_convertvector(m, v4df) - V4D(1.0)) / (__builtin_convertvector(m, v4df) + V4D(1.0));
+    z = s * s;
+    p = V4D(2.0 / 15.0);
+    p = p * z + V4D(2.0 / 13.0);
+    p = p * z + V4D(2.0 / 11.0);
+    p = p * z + V4D(2.0 / 9.0);
+    p = p * z + V4D(2.0 / 7.0);
+    p = p * z + V4D(2.0 / 5.0);
+    p = p * z + V4D(2.0 / 3.0);
+    p = s * z * p + s * V4D(2.0);
+    l = __builtin_convertvector(e, v4df);
+    l = (l * V4D(ln2_hi) + (p + l * V4D(ln2_lo))) * V4D(y);
+    if(VANY(~((l >= V4D(-87.0)) & (l <= V4D(88.0))))) return 0;
+    /* exp(l) = 2^n * exp(r) */
+    n = VRINTD(l * V4D(invln2));
+    l = l - n * V4D(ln2_hi) - n * V4D(ln2_lo);
+    p = V4D(1.0 / 362880.0);
+    p = p * l + V4D(1.0 / 40320.0);
+    p = p * l + V4D(1.0 / 5040.0);
+    p = p * l + V4D(1.0 / 720.0);
+    p = p * l + V4D(1.0 / 120.0);
+    p = p * l + V4D(1.0 / 24.0);
+    p = p * l + V4D(1.0 / 6.0);
+    p = p * l + V4D(0.5);
+    p = p * l * l + l + V4D(1.0);
+    p = p * (v4df)((__builtin_convertvector(n, v4di) + V4L(1023)) << 52);
+    *r = __builtin_convertvector(p, v4sf);
+    return 1;
+}
+
+/* sin(x + q*pi/2), valid for |x| < 2^20. The reduction is Cody-Waite in double precision with pi/2 in two parts, the
+ * first one has 33 bits so j * pio2_1 is exact. The kernels are musl's __sindf and __cosdf for [-pi/4, pi/4] */
+static inline v4sf __vsinf(v4sf x, int q)
+{
+    v4df d, j, r, z, w, s, c;
+    v4di n, swap;
+    d = __builtin_convertvector(x, v4df);
+    j = VRINTD(d * V4D(6.36619772367581382433e-01));
+    n = __builtin_convertvector(j, v4di) + V4L(q);
+    r = d - j * V4D(1.57079632673412561417e+00) - j * V4D(6.07710050650619224932e-11);
+    z = r * r;
+    w = z * z;
+    /* factored out r, so that -0 stays -0 */
+    s = r * (V4D(1.0) + z * (V4D(-1.66666666416265235595e-01) + z * V4D(8.33333293858894631756e-03)) +
+        z * w * (V4D(-1.98393348360966317347e-04) + z * V4D(2.71831149398982190640e-06)));
+    c = ((V4D(1.0) + z * V4D(-4.99999997251031003120e-01)) + w * V4D(4.16666233237390631894e-02)) +
+        w * z * (V4D(-1.38867637746099294692e-03) + z * V4D(2.43904487962774090654e-05));
+    swap = (n & V4L(1)) != V4L(0);
+    return __builtin_convertvector((v4df)((v4di)VSELD(swap, c, s) ^ ((n & V4L(2)) << 62)), v4sf);
+}
+
+void vsqrtf(float *__x, size_t __n)
+{
+    v4sf v;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+#if defined(__x86_64__)
+        __asm__("sqrtps %1, %0" : "=x"(v) : "x"(v));
+#elif defined(__aarch64__)
+        __asm__("fsqrt %0.4s, %1.4s" : "=w"(v) : "w"(v));
+#else
+        v = (v4sf){ sqrtf(v[0]), sqrtf(v[1]), sqrtf(v[2]), sqrtf(v[3]) };
+#endif
+        *(v4sf_u*)__x = v;
+    }
+    for(; __n; __n--, __x++) *__x = sqrtf(*__x);
+}
+
+void vexpf(float *__x, size_t __n)
+{
+    v4sf v;
+    int i;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+        /* also catches nan */
+        if(VANY(~((v >= V4(-87.0f)) & (v <= V4(88.0f)))))
+            for(i = 0; i < 4; i++) __x[i] = expf(__x[i]);
+        else
+            *(v4sf_u*)__x = __vexpf(v);
+    }
+    for(; __n; __n--, __x++) *__x = expf(*__x);
+}
+
+void vlogf(float *__x, size_t __n)
+{
+    v4sf v;
+    int i;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+        if(VANY(~((v >= V4(1.17549435e-38f)) & (v <= V4(3.40282347e+38f)))))
+            for(i = 0; i < 4; i++) __x[i] = logf(__x[i]);
+        else
+            *(v4sf_u*)__x = __vlogf(v);
+    }
+    for(; __n; __n--, __x++) *__x = logf(*__x);
+}
+
+void vpowf(float *__x, size_t __n, float __y)
+{
+    v4sf v;
+    int i;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+        if(!VANY(~((v >= V4(1.17549435e-38f)) & (v <= V4(3.40282347e+38f)))) && __vpowf(v, __y, &v)) {
+            *(v4sf_u*)__x = v;
+            continue;
+        }
+        for(i = 0; i < 4; i++) __x[i] = powf(__x[i], __y);
+    }
+    for(; __n; __n--, __x++) *__x = powf(*__x, __y);
+}
+
+void vsinf(float *__x, size_t __n)
+{
+    v4sf v;
+    int i;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+        if(VANY(~((v > V4(-1048576.0f)) & (v < V4(1048576.0f)))))
+            for(i = 0; i < 4; i++) __x[i] = sinf(__x[i]);
+        else
+            *(v4sf_u*)__x = __vsinf(v, 0);
+    }
+    for(; __n; __n--, __x++) *__x = sinf(*__x);
+}
+
+void vcosf(float *__x, size_t __n)
+{
+    v4sf v;
+    int i;
+    if(!__x) return;
+    for(; __n >= 4; __n -= 4, __x += 4) {
+        v = *(v4sf_u*)__x;
+        if(VANY(~((v > V4(-1048576.0f)) & (v < V4(1048576.0f)))))
+            for(i = 0; i < 4; i++) __x[i] = cosf(__x[i]);
+        else
+            *(v4sf_u*)__x = __vsinf(v, 1);
+    }
+    for(; __n; __n--, __x++) *__x = cosf(*__x);
+}
@@ -32,6 +32,9 @@
 
 /* fstat is in stdio.c because we can't access static variables otherwise... */
 
+extern void __stdio_seterrno(efi_status_t status);
+extern wchar_t *__stdio_wcname(wchar_t *buf, const char_t *name);
+
 int stat (const char_t *__file, struct stat *__buf)
 {
     int ret;
@@ -51,6 +54,41 @@ int stat (const char_t *__file, struct stat *__buf)
     return ret;
 }
 
+int fstatat (DIR *__dirp, const char_t *__file, struct stat *__buf, int __flag)
+{
+    int ret;
+    efi_status_t status;
+    FILE f;
+    wchar_t *name;
+#ifndef UEFI_NO_UTF8
+    wchar_t wcname[FILENAME_MAX];
+#else
+    wchar_t *wcname = NULL;
+#endif
+    (void)__flag;
+    if(!__dirp)
+        return stat(__file, __buf);
+    if(!__file || !*__file || !__buf) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(!(name = __stdio_wcname(wcname, __file))) {
+        memset(__buf, 0, sizeof(struct stat));
+        return -1;
+    }
+    /* no need for a real FILE, just a read-only handle relative to the directory */
+    memset(&f, 0, sizeof(FILE));
+    status = __dirp->Open(__dirp, &f.fh, name, EFI_FILE_MODE_READ, 0);
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        memset(__buf, 0, sizeof(struct stat));
+        return -1;
+    }
+    ret = fstat(&f, __buf);
+    f.fh->Close(f.fh);
+    return ret;
+}
+
 extern int mkdir (const char_t *__path, mode_t __mode)
 {
     FILE *f;
@@ -30,501 +30,3188 @@
 
 #include <uefi.h>
 
-static efi_file_handle_t *__root_dir = NULL;
 static efi_serial_io_protocol_t *__ser = NULL;
-static block_file_t *__blk_devs = NULL;
+static block_file_t **__blk_devs = NULL;
 static uintn_t __blk_ndevs = 0;
+static int __blk_stale = 0;
+static int __blk_ixstale = 1;
+static block_file_t **__nvme_devs = NULL;
+static uintn_t __nvme_ndevs = 0;
+#define __COPY_CHUNK (1024 * 1024)
+static uint8_t *__copy_buf = NULL;
+
+/* the CPU's cycle counter, or 0 where there's none */
+static inline uint64_t __cycles(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t c;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(c));
+    return c;
+#elif defined(__riscv)
+    uint64_t c;
+    __asm__ __volatile__("rdtime %0" : "=r"(c));
+    return c;
+#else
+    return 0;
+#endif
+}
+
+/* I/O statistics. Every firmware call on a stream is timed with the cycle counter */
+#ifdef UEFI_IOSTATS
+static iostat_t __ser_iostat[IOSTAT_MAX];
+
+static efi_status_t __iostat_add(iostat_t *st, efi_status_t status, uintn_t *bytes, uint64_t start)
+{
+    uint64_t t = __cycles() - start;
+    int i;
+    for(i = 0; i < IOSTAT_BUCKETS - 1 && (t >> (i + 1)); i++);
+    st->calls++;
+    st->cycles += t;
+    st->hist[i]++;
+    if(bytes && !EFI_ERROR(status)) st->bytes += *bytes;
+    return status;
+}
+
+static void __iostat_dump(const char_t *name, iostat_t *st)
+{
+    static const char_t *kinds[IOSTAT_MAX] = { CL("read"), CL("write"), CL("other") };
+    int i, j;
+    for(i = 0; i < IOSTAT_MAX; i++) {
+        if(!st[i].calls) continue;
+        fprintf(stderr, CL("iostat %s %s: %d calls, %d bytes, %d cycles, log2 histogram"), name, kinds[i],
+            st[i].calls, st[i].bytes, st[i].cycles);
+        for(j = 0; j < IOSTAT_BUCKETS; j++)
+            if(st[i].hist[j]) fprintf(stderr, CL(" %d:%d"), (uint64_t)j, st[i].hist[j]);
+        fprintf(stderr, CL("\n"));
+    }
+}
+/* the start time is local to each call, because calls nest (a file close might flush a block device) */
+#define __IOCALL(st, k, b, x) ({ uint64_t __iostat_t0 = __cycles(); __iostat_add(&(st)[k], (x), (b), __iostat_t0); })
+#else
+#define __IOCALL(st, k, b, x) (x)
+#endif
 extern time_t __mktime_efi(efi_time_t *t);
+extern efi_file_handle_t *__tmpfs_root(void);
+extern void __tmpfs_free(void);
+extern efi_file_handle_t *__archive_open(void *buf, size_t size);
+extern void *__archive_data(efi_file_handle_t *fh);
 void __stdio_cleanup(void);
 void __stdio_seterrno(efi_status_t status);
+wchar_t *__stdio_wcname(wchar_t *buf, const char_t *name);
 int __remove (const char_t *__filename, int isdir);
 
-void __stdio_cleanup(void)
+/* FILE flags */
+#define __F_READ    1   /* buffer holds read ahead data */
+#define __F_WRITE   2   /* buffer holds data not yet written */
+#define __F_OWNBUF  4   /* buffer was allocated by us */
+#define __F_MAPPED  8   /* buffer is the whole file in memory, not ours */
+#define __F_RDONLY  16  /* opened without write access, by mode or because the media is write protected */
+
+/* console output buffers for stdout and stderr. Even unbuffered streams collect one printf's output and pass it to the
+ * firmware in a single OutputString call */
+#define __CON_BUFSIZ 512
+typedef struct {
+    wchar_t *buf;
+    size_t bufsiz;
+    size_t pos;
+    int mode;
+} __con_t;
+static wchar_t __con_bufs[2][__CON_BUFSIZ + 1];
+static __con_t __con[2] = { { __con_bufs[0], __CON_BUFSIZ, 0, _IOLBF }, { __con_bufs[1], __CON_BUFSIZ, 0, _IONBF } };
+
+/* mounted volumes. The boot volume is always there, the others are listed from the firmware on first use and their
+ * root directories are opened once. MediaId is remembered to find out when removable media was replaced */
+typedef struct {
+    efi_handle_t handle;
+    efi_file_handle_t *root;
+    efi_block_io_t *bio;
+    uint32_t mediaid;
+} __vol_t;
+static __vol_t __bootvol = { 0 }, __tmpvol = { 0 }, *__vols = NULL;
+static uintn_t __nvols = 0;
+
+/* archives mounted by mount_archive. They have no firmware handle, their root is opened on mount and kept open */
+typedef struct __arcvol_s {
+    __vol_t vol;                    /* must be the first */
+    struct __arcvol_s *next;
+    uintn_t len;
+    char_t path[FILENAME_MAX];      /* mount point, without trailing slash */
+} __arcvol_t;
+static __arcvol_t *__arcvols = NULL;
+
+/* cache of directory handles keyed by volume and path, so that opening files in the same directory doesn't make the firmware walk
+ * the path again and again. The least recently used entry is replaced */
+#define __DIRCACHE_SIZE 8
+typedef struct {
+    __vol_t *vol;
+    efi_file_handle_t *fh;
+    uint64_t tick;
+    wchar_t path[FILENAME_MAX];
+} __dircache_t;
+static __dircache_t __dircache[__DIRCACHE_SIZE];
+static uint64_t __dircache_tick = 0;
+
+static void __con_flush(__con_t *c)
 {
-#ifndef UEFI_NO_UTF8
-    if(__argvutf8)
-        BS->FreePool(__argvutf8);
+    simple_text_output_interface_t *con = c == &__con[0] ? ST->ConOut : ST->StdErr;
+    if(!c->pos) return;
+    c->buf[c->pos] = 0;
+    con->OutputString(con, c->buf);
+    c->pos = 0;
+}
+
+static void __con_write(__con_t *c, const wchar_t *s, size_t n)
+{
+    int nl = 0;
+    for(; n; n--, s++) {
+        if(c->pos >= c->bufsiz) __con_flush(c);
+        c->buf[c->pos++] = *s;
+        if(*s == L'\n') nl = 1;
+    }
+    if(nl && c->mode == _IOLBF) __con_flush(c);
+}
+
+/* cache keys have no leading or trailing separators and single backslashes between the parts, so that "/a", "a", "\a"
+ * and "a//" are the same directory. Key must have room for len + 1 characters. Returns the key's length */
+static size_t __dircache_key(wchar_t *key, const wchar_t *path, size_t len)
+{
+    size_t i, n = 0;
+    for(i = 0; i < len && path[i]; i++)
+        if(path[i] == L'\\' || path[i] == L'/') {
+            if(n && key[n - 1] != L'\\') key[n++] = L'\\';
+        } else
+            key[n++] = path[i];
+    if(n && key[n - 1] == L'\\') n--;
+    key[n] = 0;
+    return n;
+}
+
+/* close cached handles of a directory and its subdirectories, or all of them on vol if path is NULL, or on every
+ * volume if vol is NULL too */
+static void __dircache_drop(__vol_t *vol, const wchar_t *path)
+{
+    wchar_t key[FILENAME_MAX];
+    size_t i, l = 0;
+    if(path) {
+        while(path[l]) l++;
+        /* can't be cached, but dropping everything on the volume is always safe */
+        if(l >= FILENAME_MAX) path = NULL;
+        else l = __dircache_key(key, path, l);
+    }
+    for(i = 0; i < __DIRCACHE_SIZE; i++)
+        if(__dircache[i].fh && (!vol || __dircache[i].vol == vol) && (!path || !l ||
+          (!memcmp(__dircache[i].path, key, l * sizeof(wchar_t)) &&
+          (!__dircache[i].path[l] || __dircache[i].path[l] == L'\\')))) {
+            __dircache[i].fh->Close(__dircache[i].fh);
+            __dircache[i].fh = NULL;
+        }
+}
+
+/* close every handle on a volume, the root will be reopened on next use */
+static void __umount(__vol_t *vol)
+{
+    __dircache_drop(vol, NULL);
+    if(vol->root) {
+        vol->root->Close(vol->root);
+        vol->root = NULL;
+    }
+}
+
+/* return the root directory of a volume, opening it if needed */
+static efi_file_handle_t *__getroot(__vol_t *vol)
+{
+    efi_status_t status;
+    efi_guid_t sfsGuid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+    efi_guid_t bioGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    efi_simple_file_system_protocol_t *sfs = NULL;
+    /* the RAM file system has no firmware handle */
+    if(vol == &__tmpvol) {
+        if(!vol->root) vol->root = __tmpfs_root();
+        return vol->root;
+    }
+    /* media was replaced since we opened it, all of our handles are stale */
+    if(vol->root && vol->bio && vol->bio->Media && vol->bio->Media->MediaId != vol->mediaid)
+        __umount(vol);
+    if(!vol->root && vol->handle) {
+        if(!vol->bio && EFI_ERROR(BS->HandleProtocol(vol->handle, &bioGuid, (void **)&vol->bio)))
+            vol->bio = NULL;
+        status = BS->HandleProtocol(vol->handle, &sfsGuid, (void **)&sfs);
+        if(!EFI_ERROR(status) && sfs)
+            status = sfs->OpenVolume(sfs, &vol->root);
+        if(EFI_ERROR(status))
+            vol->root = NULL;
+        else if(vol->bio && vol->bio->Media)
+            vol->mediaid = vol->bio->Media->MediaId;
+    }
+    return vol->root;
+}
+
+/* build the mount table, in the order the firmware lists the file systems */
+static void __mount(void)
+{
+    efi_status_t status;
+    efi_guid_t sfsGuid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+    efi_handle_t *handles = NULL;
+    uintn_t i, n = 0;
+    if(__vols) return;
+    status = BS->LocateHandleBuffer(ByProtocol, &sfsGuid, NULL, &n, &handles);
+    if(EFI_ERROR(status) || !handles) return;
+    if(n && (__vols = (__vol_t*)malloc(n * sizeof(__vol_t)))) {
+        memset(__vols, 0, n * sizeof(__vol_t));
+        for(i = 0; i < n; i++)
+            __vols[i].handle = handles[i];
+        __nvols = n;
+    }
+    BS->FreePool(handles);
+}
+
+/* select the volume by a "fsN:" or "/mnt/N/" prefix and skip that prefix. "/tmp/" is the RAM file system, and mounted
+ * archives have their own prefix. Without these, it's the boot volume */
+static __vol_t *__getvol(const char_t **path)
+{
+    const char_t *s = *path;
+    __arcvol_t *a;
+    uintn_t n = 0;
+    int fs;
+    if(!__bootvol.handle && LIP)
+        __bootvol.handle = LIP->DeviceHandle;
+    for(a = __arcvols; a; a = a->next)
+        if(!memcmp(s, a->path, a->len * sizeof(char_t)) && (!s[a->len] || s[a->len] == CL('/'))) {
+            *path = s[a->len] && s[a->len + 1] ? s + a->len + 1 : CL("\\");
+            return &a->vol;
+        }
+    if(!memcmp(s, CL("/tmp"), 4 * sizeof(char_t)) && (!s[4] || s[4] == CL('/'))) {
+        *path = s[4] && s[5] ? s + 5 : CL("\\");
+        return &__tmpvol;
+    }
+    if(s[0] == CL('f') && s[1] == CL('s') && s[2] >= CL('0') && s[2] <= CL('9')) {
+        fs = 1; s += 2;
+    } else if(!memcmp(s, CL("/mnt/"), 5 * sizeof(char_t)) && s[5] >= CL('0') && s[5] <= CL('9')) {
+        fs = 0; s += 5;
+    } else
+        return &__bootvol;
+    for(; *s >= CL('0') && *s <= CL('9'); s++)
+        n = n * 10 + (uintn_t)(*s - CL('0'));
+    if(fs ? *s != CL(':') : (*s && *s != CL('/')))
+        return &__bootvol;
+    if(fs) s++;
+    *path = *s ? s : CL("\\");
+    __mount();
+    if(n >= __nvols) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return __vols[n].handle == __bootvol.handle ? &__bootvol : &__vols[n];
+}
+
+/* return a handle for the first len characters of path */
+static efi_file_handle_t *__dircache_get(__vol_t *vol, const wchar_t *path, size_t len)
+{
+    wchar_t key[FILENAME_MAX];
+    size_t i, j = 0;
+    efi_status_t status;
+    if(len >= FILENAME_MAX || !(len = __dircache_key(key, path, len))) return NULL;
+    for(i = 0; i < __DIRCACHE_SIZE; i++) {
+        if(__dircache[i].fh && __dircache[i].vol == vol && !__dircache[i].path[len] &&
+          !memcmp(__dircache[i].path, key, len * sizeof(wchar_t))) {
+            __dircache[i].tick = ++__dircache_tick;
+            return __dircache[i].fh;
+        }
+        if(!__dircache[i].fh || (__dircache[j].fh && __dircache[i].tick < __dircache[j].tick)) j = i;
+    }
+    if(__dircache[j].fh) {
+        __dircache[j].fh->Close(__dircache[j].fh);
+        __dircache[j].fh = NULL;
+    }
+    memcpy(__dircache[j].path, key, (len + 1) * sizeof(wchar_t));
+    status = vol->root->Open(vol->root, &__dircache[j].fh, __dircache[j].path, EFI_FILE_MODE_READ, 0);
+    if(EFI_ERROR(status)) {
+        __dircache[j].fh = NULL;
+        return NULL;
+    }
+    __dircache[j].vol = vol;
+    __dircache[j].tick = ++__dircache_tick;
+    return __dircache[j].fh;
+}
+
+/* open a path from the root directory, through the cached handle of its directory if possible */
+static efi_status_t __openpath(__vol_t *vol, efi_file_handle_t **fh, wchar_t *path, uint64_t mode, uint64_t attr)
+{
+    efi_file_handle_t *dir;
+    efi_status_t status;
+    wchar_t *name = NULL, *p;
+    int retry = 1;
+    for(p = path; *p; p++)
+        if(*p == L'\\' || *p == L'/') name = p;
+again:
+    if(!__getroot(vol))
+        return EFI_NO_MEDIA;
+    if(name && name > path && name[1] && (dir = __dircache_get(vol, path, (size_t)(name - path)))) {
+        status = dir->Open(dir, fh, name + 1, mode, attr);
+        /* some firmware might not like creating files through a read-only directory handle */
+        if(!EFI_ERROR(status) || (status & 0xffff) == (EFI_NOT_FOUND & 0xffff))
+            return status;
+    }
+    status = vol->root->Open(vol->root, fh, path, mode, attr);
+    /* media changed without a new MediaId, or went away, reopen the volume once */
+    if(retry-- && ((status & 0xffff) == (EFI_MEDIA_CHANGED & 0xffff) || (status & 0xffff) == (EFI_NO_MEDIA & 0xffff))) {
+        __umount(vol);
+        goto again;
+    }
+    return status;
+}
+
+/* the parsed GPT of a disk */
+typedef struct {
+    uint32_t mediaid;               /* the table was read from this media */
+    uintn_t n;
+    block_file_t **part;            /* partition devices by entry index, NULL if unused */
+} __gpt_t;
+
+/* device streams by pointer, so telling a disk from a FILE doesn't walk every disk and partition on each call */
+typedef struct {
+    FILE *stream;
+    block_file_t *dev;
+} __blkix_t;
+static __blkix_t *__blk_ix = NULL;
+static uintn_t __blk_ixmask = 0;
+#define __BLK_HASH(p) ((uintn_t)((((uint64_t)(uintptr_t)(p) >> 4) * 0x9E3779B97F4A7C15ULL) >> 32))
+
+/* returns the block device of a stream by walking the device lists */
+static block_file_t *__blk_scan(FILE *__stream)
+{
+    __gpt_t *g;
+    uintn_t i, j;
+    for(i = 0; i < __blk_ndevs; i++)
+        if(__stream == (FILE*)__blk_devs[i]->bio)
+            return __blk_devs[i];
+    /* NVMe namespaces and partitions are returned as their own block_file_t */
+    for(i = 0; i < __nvme_ndevs; i++)
+        if(__stream == (FILE*)__nvme_devs[i])
+            return __nvme_devs[i];
+    for(i = 0; i < __blk_ndevs + __nvme_ndevs; i++)
+        if((g = (__gpt_t*)(i < __blk_ndevs ? __blk_devs[i] : __nvme_devs[i - __blk_ndevs])->gpt))
+            for(j = 0; j < g->n; j++)
+                if(__stream == (FILE*)g->part[j])
+                    return g->part[j];
+    return NULL;
+}
+
+static void __blk_ixadd(FILE *__stream, block_file_t *__dev)
+{
+    uintn_t h;
+    for(h = __BLK_HASH(__stream) & __blk_ixmask; __blk_ix[h].stream; h = (h + 1) & __blk_ixmask);
+    __blk_ix[h].stream = __stream;
+    __blk_ix[h].dev = __dev;
+}
+
+/* rebuild the index after the device lists have changed. Returns 0 if there's no memory for it */
+static int __blk_reindex(void)
+{
+    block_file_t *d;
+    __gpt_t *g;
+    uintn_t i, j, n = 0, size;
+    for(i = 0; i < __blk_ndevs + __nvme_ndevs; i++)
+        if((g = (__gpt_t*)(i < __blk_ndevs ? __blk_devs[i] : __nvme_devs[i - __blk_ndevs])->gpt))
+            n += g->n + 1;
+        else
+            n++;
+    /* keep the table at most half full so probe runs stay short */
+    for(size = 16; size < 2 * n; size <<= 1);
+    if(!__blk_ix || size - 1 != __blk_ixmask) {
+        if(__blk_ix) free(__blk_ix);
+        __blk_ixmask = 0;
+        if(!(__blk_ix = (__blkix_t*)malloc(size * sizeof(__blkix_t)))) return 0;
+        __blk_ixmask = size - 1;
+    }
+    memset(__blk_ix, 0, size * sizeof(__blkix_t));
+    for(i = 0; i < __blk_ndevs + __nvme_ndevs; i++) {
+        d = i < __blk_ndevs ? __blk_devs[i] : __nvme_devs[i - __blk_ndevs];
+        __blk_ixadd(i < __blk_ndevs ? (FILE*)d->bio : (FILE*)d, d);
+        if((g = (__gpt_t*)d->gpt))
+            for(j = 0; j < g->n; j++)
+                if(g->part[j])
+                    __blk_ixadd((FILE*)g->part[j], g->part[j]);
+    }
+    __blk_ixstale = 0;
+    return 1;
+}
+
+/* returns the block device of a stream, or NULL if it's not a disk */
+static block_file_t *__blk_find(FILE *__stream)
+{
+    uintn_t h;
+    if(!__blk_ndevs && !__nvme_ndevs)
+        return NULL;
+    if(__blk_ixstale && !__blk_reindex())
+        return __blk_scan(__stream);
+    for(h = __BLK_HASH(__stream) & __blk_ixmask; __blk_ix[h].stream; h = (h + 1) & __blk_ixmask)
+        if(__blk_ix[h].stream == __stream)
+            return __blk_ix[h].dev;
+    return NULL;
+}
+
+/* the cached media info of a device, refreshed when the firmware reports another media */
+static efi_block_io_media_t *__blk_media(block_file_t *__dev)
+{
+    /* NVMe namespaces have no Block IO, their media info comes from Identify Namespace */
+    if(__dev->bio && __dev->media.MediaId != __dev->bio->Media->MediaId) {
+        memcpy(&__dev->media, __dev->bio->Media, sizeof(efi_block_io_media_t));
+        /* new media might come with other partitions, so list the devices again on the next fopen */
+        __blk_stale = 1;
+    }
+    return &__dev->media;
+}
+
+/* the whole disk of a partition, or the disk itself */
+#define __blk_disk(d) ((d)->disk ? (block_file_t*)(d)->disk : (d))
+
+/* size of a disk or a partition in bytes */
+static off_t __blk_size(block_file_t *__dev)
+{
+    efi_block_io_media_t *media;
+    if(__dev->disk) return __dev->size;
+    media = __blk_media(__dev);
+    return (off_t)media->BlockSize * ((off_t)media->LastBlock + 1);
+}
+
+/* readahead of sequential freads on devices with asynchronous access, several requests are kept in flight */
+#define __RA_CHUNK 65536
+#define __RA_DEPTH 4
+
+typedef struct {
+    efi_block_io2_token_t token;    /* Event is NULL if there's no request in flight */
+    off_t off;
+    uintn_t len;                    /* 0 if the slot is free */
+} __raslot_t;
+
+typedef struct {
+    off_t next;                     /* end of the last read, a read starting here is sequential */
+    uint32_t mediaid;
+    uintn_t chunk;
+    uint8_t *buf;                   /* __RA_DEPTH chunks, page aligned */
+    __raslot_t slot[__RA_DEPTH];
+} __blkra_t;
+
+/* wait for a readahead request to finish, returns 0 if it has failed */
+static int __ra_wait(__raslot_t *__s)
+{
+    uintn_t idx;
+    if(__s->token.Event) {
+        BS->WaitForEvent(1, &__s->token.Event, &idx);
+        BS->CloseEvent(__s->token.Event);
+        __s->token.Event = NULL;
+        if(EFI_ERROR(__s->token.TransactionStatus)) __s->len = 0;
+    }
+    return __s->len != 0;
+}
+
+/* forget the read ahead data, the firmware must not write into the buffer after this */
+static void __ra_drop(block_file_t *__dev)
+{
+    __blkra_t *ra = (__blkra_t*)__dev->ahead;
+    int i;
+    if(!ra) return;
+    for(i = 0; i < __RA_DEPTH; i++) {
+        __ra_wait(&ra->slot[i]);
+        ra->slot[i].len = 0;
+    }
+    ra->next = (off_t)-1;
+}
+
+static void __ra_free(block_file_t *__dev)
+{
+    __blkra_t *ra = (__blkra_t*)__dev->ahead;
+    if(!ra) return;
+    __ra_drop(__dev);
+    if(ra->buf)
+        BS->FreePages((efi_physical_address_t)(uintptr_t)ra->buf, EFI_SIZE_TO_PAGES(__RA_DEPTH * ra->chunk));
+    free(ra);
+    __dev->ahead = NULL;
+}
+
+/* queue a readahead request, Disk IO2 takes any offset, Block IO2 whole blocks only */
+static off_t __ra_submit(block_file_t *__dev, __raslot_t *__s, off_t __off)
+{
+    __blkra_t *ra = (__blkra_t*)__dev->ahead;
+    efi_block_io_t *bio = __dev->bio;
+    efi_block_io_media_t *media = __blk_media(__dev);
+    off_t end = (off_t)media->BlockSize * ((off_t)media->LastBlock + 1);
+    uint8_t *buf = ra->buf + (__s - ra->slot) * ra->chunk;
+    efi_status_t status;
+    uintn_t len;
+
+    if(__off >= end || (!__dev->dio2 && __off % media->BlockSize)) return __off;
+    len = end - __off < ra->chunk ? (uintn_t)(end - __off) : ra->chunk;
+    if(EFI_ERROR(BS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &__s->token.Event))) {
+        __s->token.Event = NULL;
+        return __off;
+    }
+    __s->token.TransactionStatus = EFI_SUCCESS;
+    /* the Disk IO2 token has the same layout */
+    status = __dev->dio2 ?
+        __IOCALL(__dev->iostat, IOSTAT_READ, &len, __dev->dio2->ReadDiskEx(__dev->dio2, bio->Media->MediaId, __off,
+            (efi_disk_io2_token_t*)&__s->token, len, buf)) :
+        __IOCALL(__dev->iostat, IOSTAT_READ, &len, __dev->bio2->ReadBlocksEx(__dev->bio2, bio->Media->MediaId,
+            __off / media->BlockSize, &__s->token, len, buf));
+    if(EFI_ERROR(status)) {
+        BS->CloseEvent(__s->token.Event);
+        __s->token.Event = NULL;
+        return __off;
+    }
+    __s->off = __off;
+    __s->len = len;
+    return __off + len;
+}
+
+/* NVMe namespaces are driven through the pass-through protocol, so that big transfers are split into commands which
+ * are all kept in flight at once instead of going one by one through the synchronous Block IO shim */
+#ifndef UEFI_NVME_DEPTH
+#define UEFI_NVME_DEPTH 32
 #endif
-    if(__blk_devs) {
-        free(__blk_devs);
-        __blk_devs = NULL;
-        __blk_ndevs = 0;
+#define __NVME_CHUNK    (128 * 1024)
+#define __NVME_TIMEOUT  50000000            /* 5 seconds in 100ns units */
+#define __NVME_FLUSH    0x00
+#define __NVME_WRITE    0x01
+#define __NVME_READ     0x02
+#define __NVME_IDENTIFY 0x06
+
+typedef struct {
+    efi_nvme_packet_t packet;
+    efi_nvme_command_t cmd;
+    efi_nvme_completion_t cpl;
+    efi_event_t event;              /* NULL for blocking commands */
+    uint8_t *buf;
+    uintn_t pos, len;               /* the part of the caller's buffer this command transfers */
+} __nvmeslot_t;
+
+typedef struct {
+    uintn_t chunk;                  /* bytes per command, limited by the controller's MDTS */
+    uintn_t depth;                  /* commands in flight, 1 if the controller can't do non-blocking I/O */
+    uint8_t *bounce;                /* depth chunks for buffers not meeting IoAlign, allocated on first use */
+    __nvmeslot_t slot[1];
+} __nvmeq_t;
+
+/* fill in a command packet. For reads and writes cdw10-12 are the lba and the number of blocks minus one, for identify
+ * cdw10 is the CNS value */
+static void __nvme_cmd(__nvmeslot_t *__s, uint32_t __nsid, uint8_t __queue, uint8_t __opcode, uint64_t __cdw10,
+    uint32_t __cdw12, void *__buf, uintn_t __len)
+{
+    memset(&__s->packet, 0, sizeof(efi_nvme_packet_t));
+    memset(&__s->cmd, 0, sizeof(efi_nvme_command_t));
+    memset(&__s->cpl, 0, sizeof(efi_nvme_completion_t));
+    __s->cmd.Cdw0 = __opcode;
+    __s->cmd.Nsid = __nsid;
+    if(__opcode != __NVME_FLUSH) {
+        __s->cmd.Cdw10 = (uint32_t)__cdw10;
+        __s->cmd.Cdw11 = (uint32_t)(__cdw10 >> 32);
+        __s->cmd.Cdw12 = __cdw12;
+        __s->cmd.Flags = CDW10_VALID | CDW11_VALID | CDW12_VALID;
     }
+    __s->packet.CommandTimeout = __NVME_TIMEOUT;
+    __s->packet.TransferBuffer = __buf;
+    __s->packet.TransferLength = (uint32_t)__len;
+    __s->packet.QueueType = __queue;
+    __s->packet.NvmeCmd = &__s->cmd;
+    __s->packet.NvmeCompletion = &__s->cpl;
 }
 
-void __stdio_seterrno(efi_status_t status)
+/* the firmware only reports transport errors, the command's own status is in the completion entry */
+#define __nvme_status(s) (((s)->cpl.DW3 >> 17) & 0x7ff ? EFI_DEVICE_ERROR : EFI_SUCCESS)
+
+/* read or write whole blocks of a namespace, keeping up to depth commands in flight. Returns after all have finished */
+static efi_status_t __nvme_rw(block_file_t *__dev, int __write, off_t __off, uintn_t __n, void *__buf)
 {
-    switch((int)(status & 0xffff)) {
-        case EFI_WRITE_PROTECTED & 0xffff: errno = EROFS; break;
-        case EFI_ACCESS_DENIED & 0xffff: errno = EACCES; break;
-        case EFI_VOLUME_FULL & 0xffff: errno = ENOSPC; break;
-        case EFI_NOT_FOUND & 0xffff: errno = ENOENT; break;
-        case EFI_INVALID_PARAMETER & 0xffff: errno = EINVAL; break;
-        default: errno = EIO; break;
+    __nvmeq_t *q = (__nvmeq_t*)__dev->queue;
+    efi_physical_address_t addr;
+    efi_status_t status = EFI_SUCCESS, st;
+    uintn_t bsize = __dev->media.BlockSize, pos = 0, head = 0, tail = 0, len, idx;
+    uint8_t *buf = (uint8_t*)__buf;
+    __nvmeslot_t *s;
+    int direct;
+
+    direct = __dev->media.IoAlign < 2 || !((uintptr_t)buf % __dev->media.IoAlign);
+    if(!direct && !q->bounce) {
+        if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(q->depth * q->chunk), &addr)))
+            return EFI_OUT_OF_RESOURCES;
+        q->bounce = (uint8_t*)addr;
+    }
+    while(pos < __n || head != tail) {
+        /* keep the queue full */
+        for(; !EFI_ERROR(status) && pos < __n && tail - head < q->depth; tail++, pos += len) {
+            s = &q->slot[tail % q->depth];
+            len = __n - pos < q->chunk ? __n - pos : q->chunk;
+            s->buf = direct ? buf + pos : q->bounce + (tail % q->depth) * q->chunk;
+            s->pos = pos;
+            s->len = len;
+            if(__write && !direct) memcpy(s->buf, buf + pos, len);
+            __nvme_cmd(s, __dev->nsid, NVME_IO_QUEUE, __write ? __NVME_WRITE : __NVME_READ, (__off + pos) / bsize,
+                (uint32_t)(len / bsize - 1), s->buf, len);
+            if(q->depth < 2 || EFI_ERROR(BS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &s->event)))
+                s->event = NULL;
+            status = __IOCALL(__dev->iostat, __write ? IOSTAT_WRITE : IOSTAT_READ, &len,
+                __dev->nvme->PassThru(__dev->nvme, __dev->nsid, &s->packet, s->event));
+            if(EFI_ERROR(status)) {
+                if(s->event) BS->CloseEvent(s->event);
+                s->event = NULL;
+                /* the firmware's queue is full, retry after the oldest command has finished */
+                if((status & 0xffff) == (EFI_NOT_READY & 0xffff) && head != tail) status = EFI_SUCCESS;
+                break;
+            }
+        }
+        if(head == tail) break;
+        /* the oldest command is the first to wait for */
+        s = &q->slot[head++ % q->depth];
+        if(s->event) {
+            BS->WaitForEvent(1, &s->event, &idx);
+            BS->CloseEvent(s->event);
+            s->event = NULL;
+        }
+        st = __nvme_status(s);
+        if(EFI_ERROR(st)) {
+            if(!EFI_ERROR(status)) status = st;
+        } else
+        if(!__write && !direct)
+            memcpy(buf + s->pos, s->buf, s->len);
+    }
+    return status;
+}
+
+static efi_status_t __nvme_flush(block_file_t *__dev)
+{
+    __nvmeq_t *q = (__nvmeq_t*)__dev->queue;
+    efi_status_t status;
+    __nvme_cmd(&q->slot[0], __dev->nsid, NVME_IO_QUEUE, __NVME_FLUSH, 0, 0, NULL, 0);
+    status = __IOCALL(__dev->iostat, IOSTAT_OTHER, NULL, __dev->nvme->PassThru(__dev->nvme, __dev->nsid, &q->slot[0].packet,
+        NULL));
+    return EFI_ERROR(status) ? status : __nvme_status(&q->slot[0]);
+}
+
+/* read or write a block device. With Disk IO any offset and size goes, otherwise they must be multiples of the block size */
+static efi_status_t __blk_raw(block_file_t *__dev, int __write, off_t __off, uintn_t __n, void *__buf)
+{
+    efi_block_io_t *bio = __dev->bio;
+    efi_disk_io2_token_t token;
+    if(__write)
+        __ra_drop(__dev);
+    if(__dev->nvme)
+        return __nvme_rw(__dev, __write, __off, __n, __buf);
+    if(__dev->dio2) {
+        /* no event, so it's a blocking call */
+        token.Event = NULL;
+        token.TransactionStatus = EFI_SUCCESS;
+        return __IOCALL(__dev->iostat, __write ? IOSTAT_WRITE : IOSTAT_READ, &__n, __write ?
+            __dev->dio2->WriteDiskEx(__dev->dio2, bio->Media->MediaId, __off, &token, __n, __buf) :
+            __dev->dio2->ReadDiskEx(__dev->dio2, bio->Media->MediaId, __off, &token, __n, __buf));
+    }
+    if(__dev->dio)
+        return __IOCALL(__dev->iostat, __write ? IOSTAT_WRITE : IOSTAT_READ, &__n, __write ?
+            __dev->dio->WriteDisk(__dev->dio, bio->Media->MediaId, __off, __n, __buf) :
+            __dev->dio->ReadDisk(__dev->dio, bio->Media->MediaId, __off, __n, __buf));
+    return __IOCALL(__dev->iostat, __write ? IOSTAT_WRITE : IOSTAT_READ, &__n, __write ?
+        bio->WriteBlocks(bio, bio->Media->MediaId, __off / __blk_media(__dev)->BlockSize, __n, __buf) :
+        bio->ReadBlocks(bio, bio->Media->MediaId, __off / __blk_media(__dev)->BlockSize, __n, __buf));
+}
+
+/* the granularity of the transfers, 1 with Disk IO, the block size otherwise */
+#define __blk_unit(d) ((d)->dio || (d)->dio2 ? 1 : __blk_media(d)->BlockSize)
+
+/* size of the page aligned bounce buffers used to merge disk transfers */
+#define __BOUNCE_SIZE 65536
+
+/* write-back block cache of a disk device, set up with setvbuf */
+typedef struct {
+    uint64_t lba;           /* cached block, or -1 if the slot is free */
+    uint64_t tick;          /* last access, the least recently used slot is evicted */
+    int dirty;
+} __bcslot_t;
+
+typedef struct {
+    uintn_t n;
+    uint32_t mediaid;
+    uint64_t tick;
+    uint8_t *data;          /* n blocks, page aligned */
+    __bcslot_t slot[1];
+} __bcache_t;
+
+#define __bc_data(c, s, bsize) ((c)->data + (uintn_t)((s) - (c)->slot) * (bsize))
+
+static int __bc_cmp(const void *a, const void *b)
+{
+    uint64_t x = (*(__bcslot_t**)a)->lba, y = (*(__bcslot_t**)b)->lba;
+    return x < y ? -1 : x > y;
+}
+
+/* write back all dirty blocks, runs of adjacent blocks are merged into single calls */
+static efi_status_t __bc_flush(block_file_t *__dev)
+{
+    __bcache_t *c = (__bcache_t*)__dev->cache;
+    efi_status_t status = EFI_SUCCESS;
+    efi_physical_address_t addr = 0;
+    uintn_t bsize = __blk_media(__dev)->BlockSize, max, i, j, k, nd;
+    __bcslot_t **d;
+    uint8_t *buf;
+
+    if(!c) return EFI_SUCCESS;
+    d = (__bcslot_t**)malloc(c->n * sizeof(__bcslot_t*));
+    if(!d) return EFI_OUT_OF_RESOURCES;
+    for(i = nd = 0; i < c->n; i++)
+        if(c->slot[i].dirty) d[nd++] = &c->slot[i];
+    qsort(d, nd, sizeof(__bcslot_t*), __bc_cmp);
+    max = bsize < __BOUNCE_SIZE ? __BOUNCE_SIZE / bsize : 1;
+    for(i = 0; i < nd; i = j) {
+        for(j = i + 1; j < nd && j - i < max && d[j]->lba == d[i]->lba + (j - i); j++);
+        if(j - i == 1)
+            buf = __bc_data(c, d[i], bsize);
+        else {
+            if(!addr) {
+                status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(max * bsize), &addr);
+                if(EFI_ERROR(status)) break;
+            }
+            buf = (uint8_t*)addr;
+            for(k = i; k < j; k++)
+                memcpy(buf + (k - i) * bsize, __bc_data(c, d[k], bsize), bsize);
+        }
+        status = __blk_raw(__dev, 1, d[i]->lba * bsize, (j - i) * bsize, buf);
+        if(EFI_ERROR(status)) break;
+        for(k = i; k < j; k++)
+            d[k]->dirty = 0;
+    }
+    if(addr)
+        BS->FreePages(addr, EFI_SIZE_TO_PAGES(max * bsize));
+    free(d);
+    return status;
+}
+
+/* return the slot of a block, loading it from the device on a miss unless the caller overwrites it entirely */
+static __bcslot_t *__bc_get(block_file_t *__dev, uint64_t __lba, int __load, efi_status_t *__status)
+{
+    __bcache_t *c = (__bcache_t*)__dev->cache;
+    uintn_t bsize = __blk_media(__dev)->BlockSize, i;
+    __bcslot_t *s = NULL;
+
+    for(i = 0; i < c->n; i++) {
+        if(c->slot[i].lba == __lba) { s = &c->slot[i]; goto found; }
+        if(!s || c->slot[i].tick < s->tick) s = &c->slot[i];
+    }
+    /* evicting a dirty block writes back all of them, so that adjacent ones get merged */
+    if(s->dirty && EFI_ERROR((*__status = __bc_flush(__dev))))
+        return NULL;
+    s->lba = __lba;
+    if(__load && EFI_ERROR((*__status = __blk_raw(__dev, 0, __lba * bsize, bsize, __bc_data(c, s, bsize))))) {
+        s->lba = (uint64_t)-1;
+        s->tick = 0;
+        return NULL;
+    }
+found:
+    s->tick = ++c->tick;
+    return s;
+}
+
+/* read or write a block device through its cache, if it has one */
+static efi_status_t __blk_rw(block_file_t *__dev, int __write, off_t __off, uintn_t __n, void *__buf)
+{
+    __bcache_t *c = (__bcache_t*)__dev->cache;
+    efi_status_t status = EFI_SUCCESS;
+    uintn_t bsize = __blk_media(__dev)->BlockSize, i, o, l;
+    uint64_t first, last, bo;
+    uint8_t *p = (uint8_t*)__buf;
+    __bcslot_t *s;
+
+    if(!c || !__n)
+        return __blk_raw(__dev, __write, __off, __n, __buf);
+    /* the media was changed, nothing cached is valid any more */
+    if(c->mediaid != __blk_media(__dev)->MediaId) {
+        for(i = 0; i < c->n; i++) {
+            c->slot[i].lba = (uint64_t)-1;
+            c->slot[i].tick = 0;
+            c->slot[i].dirty = 0;
+        }
+        c->mediaid = __blk_media(__dev)->MediaId;
+    }
+    first = __off / bsize;
+    last = (__off + __n - 1) / bsize;
+    /* big transfers bypass the cache so that streaming does not evict everything, but they must see the cached data */
+    if(last - first >= (c->n + 3) / 4) {
+        status = __blk_raw(__dev, __write, __off, __n, __buf);
+        if(EFI_ERROR(status)) return status;
+        for(i = 0; i < c->n; i++)
+            if(c->slot[i].lba >= first && c->slot[i].lba <= last && (__write || c->slot[i].dirty)) {
+                bo = c->slot[i].lba * bsize;
+                o = bo < __off ? __off - bo : 0;
+                l = (bo + bsize < __off + __n ? bsize : __off + __n - bo) - o;
+                if(__write) memcpy(__bc_data(c, &c->slot[i], bsize) + o, p + (bo + o - __off), l);
+                else memcpy(p + (bo + o - __off), __bc_data(c, &c->slot[i], bsize) + o, l);
+            }
+        return status;
+    }
+    for(o = __off % bsize; __n; first++, o = 0) {
+        l = bsize - o;
+        if(l > __n) l = __n;
+        s = __bc_get(__dev, first, !__write || l < bsize, &status);
+        if(!s) return status;
+        if(__write) {
+            memcpy(__bc_data(c, s, bsize) + o, p, l);
+            s->dirty = 1;
+        } else
+            memcpy(p, __bc_data(c, s, bsize) + o, l);
+        p += l; __n -= l;
+    }
+    return status;
+}
+
+/* set up or remove the block cache of a device, n is in bytes, 0 removes the cache */
+static int __bc_setup(block_file_t *__dev, size_t __n)
+{
+    __bcache_t *c = (__bcache_t*)__dev->cache;
+    efi_physical_address_t addr;
+    uintn_t bsize = __blk_media(__dev)->BlockSize, i;
+    efi_status_t status;
+
+    if(c) {
+        status = __bc_flush(__dev);
+        if(EFI_ERROR(status)) {
+            __stdio_seterrno(status);
+            return -1;
+        }
+        BS->FreePages((efi_physical_address_t)(uintptr_t)c->data, EFI_SIZE_TO_PAGES(c->n * bsize));
+        free(c);
+        __dev->cache = NULL;
+    }
+    if(!__n) return 0;
+    /* the cache and the readahead don't mix */
+    __ra_free(__dev);
+    i = __n < bsize ? 1 : __n / bsize;
+    c = (__bcache_t*)malloc(sizeof(__bcache_t) + (i - 1) * sizeof(__bcslot_t));
+    if(!c) {
+        errno = ENOMEM;
+        return -1;
+    }
+    status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(i * bsize), &addr);
+    if(EFI_ERROR(status)) {
+        free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->n = i;
+    c->mediaid = __blk_media(__dev)->MediaId;
+    c->tick = 0;
+    c->data = (uint8_t*)addr;
+    for(i = 0; i < c->n; i++) {
+        c->slot[i].lba = (uint64_t)-1;
+        c->slot[i].tick = 0;
+        c->slot[i].dirty = 0;
+    }
+    __dev->cache = c;
+    return 0;
+}
+
+/* write back the cache and ask the firmware to flush its own */
+static efi_status_t __blk_flush(block_file_t *__dev)
+{
+    efi_status_t status = __bc_flush(__dev);
+    if(!EFI_ERROR(status) && __dev->nvme)
+        status = __nvme_flush(__dev);
+    else
+    if(!EFI_ERROR(status) && __dev->bio->FlushBlocks)
+        status = __IOCALL(__dev->iostat, IOSTAT_OTHER, NULL, __dev->bio->FlushBlocks(__dev->bio));
+    return status;
+}
+
+/* read and check a GPT header and its entry array at lba. Returns the entries in allocated pages or NULL */
+static uint8_t *__gpt_read(block_file_t *__disk, efi_lba_t __lba, uint8_t *__hbuf, uintn_t *__pages)
+{
+    efi_partition_table_header_t *hdr = (efi_partition_table_header_t*)__hbuf;
+    efi_block_io_media_t *media = __blk_media(__disk);
+    efi_physical_address_t addr;
+    uintn_t bsize = media->BlockSize, size;
+    uint32_t crc, saved;
+
+    if(EFI_ERROR(__blk_rw(__disk, 0, __lba * bsize, bsize, __hbuf)) ||
+        memcmp(&hdr->Header.Signature, EFI_PTAB_HEADER_ID, 8) || hdr->Header.HeaderSize < 92 ||
+        hdr->Header.HeaderSize > bsize || hdr->MyLBA != __lba || !hdr->NumberOfPartitionEntries ||
+        hdr->NumberOfPartitionEntries > 65536 || hdr->SizeOfPartitionEntry < sizeof(efi_partition_entry_t) ||
+        hdr->SizeOfPartitionEntry > 4096 || (hdr->SizeOfPartitionEntry & 7))
+        return NULL;
+    saved = hdr->Header.CRC32;
+    hdr->Header.CRC32 = 0;
+    if(EFI_ERROR(BS->CalculateCrc32(hdr, hdr->Header.HeaderSize, &crc)) || crc != saved)
+        return NULL;
+    size = (hdr->NumberOfPartitionEntries * hdr->SizeOfPartitionEntry + bsize - 1) / bsize * bsize;
+    if(hdr->PartitionEntryLBA > media->LastBlock || size / bsize > media->LastBlock - hdr->PartitionEntryLBA + 1)
+        return NULL;
+    *__pages = EFI_SIZE_TO_PAGES(size);
+    if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, *__pages, &addr)))
+        return NULL;
+    if(EFI_ERROR(__blk_rw(__disk, 0, hdr->PartitionEntryLBA * bsize, size, (void*)addr)) ||
+        EFI_ERROR(BS->CalculateCrc32((void*)addr, hdr->NumberOfPartitionEntries * hdr->SizeOfPartitionEntry, &crc)) ||
+        crc != hdr->PartitionEntryArrayCRC32) {
+        BS->FreePages(addr, *__pages);
+        return NULL;
+    }
+    return (uint8_t*)addr;
+}
+
+/* parse the GPT of a disk, falling back to the backup table at the end if the primary is damaged. The partition
+ * devices are kept across media changes, because they might be open */
+static void __gpt_load(block_file_t *__disk)
+{
+    static const efi_guid_t unused = { 0 };
+    efi_block_io_media_t *media = __blk_media(__disk);
+    efi_partition_table_header_t *hdr;
+    efi_partition_entry_t *e;
+    efi_physical_address_t addr;
+    __gpt_t *g = (__gpt_t*)__disk->gpt;
+    block_file_t **parts, *p;
+    uintn_t bsize = media->BlockSize, pages = 0, i;
+    uint8_t *ent = NULL;
+
+    if(!g) {
+        if(!(g = (__gpt_t*)malloc(sizeof(__gpt_t)))) return;
+        memset(g, 0, sizeof(__gpt_t));
+        __disk->gpt = g;
+    }
+    g->mediaid = media->MediaId;
+    __blk_ixstale = 1;
+    for(i = 0; i < g->n; i++)
+        if(g->part[i]) g->part[i]->size = 0;
+    if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(bsize), &addr)))
+        return;
+    hdr = (efi_partition_table_header_t*)addr;
+    if(!(ent = __gpt_read(__disk, 1, (uint8_t*)addr, &pages)) && media->LastBlock > 1)
+        ent = __gpt_read(__disk, media->LastBlock, (uint8_t*)addr, &pages);
+    if(ent) {
+        if(hdr->NumberOfPartitionEntries > g->n &&
+          (parts = (block_file_t**)realloc(g->part, hdr->NumberOfPartitionEntries * sizeof(block_file_t*)))) {
+            memset(parts + g->n, 0, (hdr->NumberOfPartitionEntries - g->n) * sizeof(block_file_t*));
+            g->part = parts;
+            g->n = hdr->NumberOfPartitionEntries;
+        }
+        for(i = 0; i < g->n && i < hdr->NumberOfPartitionEntries; i++) {
+            e = (efi_partition_entry_t*)(ent + i * hdr->SizeOfPartitionEntry);
+            if(!memcmp(&e->PartitionTypeGUID, &unused, sizeof(efi_guid_t)) || e->StartingLBA > e->EndingLBA ||
+                e->EndingLBA > media->LastBlock)
+                continue;
+            if(!(p = g->part[i])) {
+                if(!(p = (block_file_t*)malloc(sizeof(block_file_t)))) continue;
+                memset(p, 0, sizeof(block_file_t));
+                p->disk = __disk;
+                p->bio = __disk->bio; p->bio2 = __disk->bio2; p->dio = __disk->dio; p->dio2 = __disk->dio2;
+                g->part[i] = p;
+            }
+            memcpy(&p->media, media, sizeof(efi_block_io_media_t));
+            p->start = (off_t)e->StartingLBA * bsize;
+            p->size = (off_t)(e->EndingLBA - e->StartingLBA + 1) * bsize;
+        }
+        BS->FreePages((efi_physical_address_t)(uintptr_t)ent, pages);
+    }
+    BS->FreePages(addr, EFI_SIZE_TO_PAGES(bsize));
+}
+
+/* free the partition devices of a disk */
+static void __gpt_free(block_file_t *__disk)
+{
+    __gpt_t *g = (__gpt_t*)__disk->gpt;
+    uintn_t i;
+    if(!g) return;
+    __blk_ixstale = 1;
+    for(i = 0; i < g->n; i++)
+        if(g->part[i]) free(g->part[i]);
+    if(g->part) free(g->part);
+    free(g);
+    __disk->gpt = NULL;
+}
+
+/* returns partition idx (counting from 1) of a disk, the GPT is parsed on first use and after a media change */
+static block_file_t *__blk_part(block_file_t *__disk, uintn_t __idx)
+{
+    __gpt_t *g = (__gpt_t*)__disk->gpt;
+    if(!g || g->mediaid != __blk_media(__disk)->MediaId) {
+        __gpt_load(__disk);
+        g = (__gpt_t*)__disk->gpt;
+    }
+    return g && __idx > 0 && __idx <= g->n && g->part[__idx - 1] && g->part[__idx - 1]->size ? g->part[__idx - 1] : NULL;
+}
+
+/* forget a device that's gone, without calling its protocols */
+static void __blk_forget(block_file_t *__dev)
+{
+    __bcache_t *c = (__bcache_t*)__dev->cache;
+    __blkra_t *ra = (__blkra_t*)__dev->ahead;
+    int i;
+    if(c) {
+        BS->FreePages((efi_physical_address_t)(uintptr_t)c->data, EFI_SIZE_TO_PAGES(c->n * __dev->media.BlockSize));
+        free(c);
+    }
+    if(ra) {
+        for(i = 0; i < __RA_DEPTH; i++)
+            if(ra->slot[i].token.Event)
+                BS->CloseEvent(ra->slot[i].token.Event);
+        if(ra->buf)
+            BS->FreePages((efi_physical_address_t)(uintptr_t)ra->buf, EFI_SIZE_TO_PAGES(__RA_DEPTH * ra->chunk));
+        free(ra);
+    }
+    __gpt_free(__dev);
+    free(__dev);
+}
+
+/* list the block devices in the order the firmware reports them. Devices we already know keep their state */
+static void __blk_enum(void)
+{
+    efi_guid_t bioGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    efi_guid_t bio2Guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+    efi_guid_t dioGuid = EFI_DISK_IO_PROTOCOL_GUID;
+    efi_guid_t dio2Guid = EFI_DISK_IO2_PROTOCOL_GUID;
+    efi_handle_t *handles = NULL;
+    efi_block_io_t *bio;
+    block_file_t **devs = NULL, *dev;
+    uintn_t i, j, n = 0, nd = 0;
+
+    if(EFI_ERROR(BS->LocateHandleBuffer(ByProtocol, &bioGuid, NULL, &n, &handles)) || !handles)
+        n = 0;
+    if(n && !(devs = (block_file_t**)malloc(n * sizeof(block_file_t*)))) {
+        BS->FreePool(handles);
+        return;
+    }
+    __blk_stale = 0;
+    for(i = 0; i < n; i++) {
+        if(!handles[i] || EFI_ERROR(BS->HandleProtocol(handles[i], &bioGuid, (void **) &bio)) || !bio || !bio->Media ||
+            !bio->Media->BlockSize)
+            continue;
+#ifdef UEFI_WHOLE_DISKS
+        /* the firmware installs Block IO on every partition too */
+        if(bio->Media->LogicalPartition)
+            continue;
+#endif
+        for(j = 0, dev = NULL; j < __blk_ndevs && !dev; j++)
+            if(__blk_devs[j] && __blk_devs[j]->bio == bio) {
+                dev = __blk_devs[j];
+                __blk_devs[j] = NULL;
+            }
+        if(!dev) {
+            if(!(dev = (block_file_t*)malloc(sizeof(block_file_t)))) continue;
+            memset(dev, 0, sizeof(block_file_t));
+            dev->handle = handles[i];
+            dev->bio = bio;
+            if(EFI_ERROR(BS->HandleProtocol(handles[i], &bio2Guid, (void **) &dev->bio2)))
+                dev->bio2 = NULL;
+            /* byte granular access, if the firmware has it on this device */
+            if(EFI_ERROR(BS->HandleProtocol(handles[i], &dio2Guid, (void **) &dev->dio2)))
+                dev->dio2 = NULL;
+            if(EFI_ERROR(BS->HandleProtocol(handles[i], &dioGuid, (void **) &dev->dio)))
+                dev->dio = NULL;
+        }
+        memcpy(&dev->media, bio->Media, sizeof(efi_block_io_media_t));
+        devs[nd++] = dev;
+    }
+    for(j = 0; j < __blk_ndevs; j++)
+        if(__blk_devs[j])
+            __blk_forget(__blk_devs[j]);
+    if(__blk_devs)
+        free(__blk_devs);
+    if(handles)
+        BS->FreePool(handles);
+    __blk_devs = devs;
+    __blk_ndevs = nd;
+    __blk_ixstale = 1;
+}
+
+/* list the NVMe namespaces of all controllers. Inactive namespaces and ones with metadata are skipped */
+static void __nvme_enum(void)
+{
+    efi_guid_t nvmeGuid = EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL_GUID;
+    efi_handle_t *handles = NULL;
+    efi_nvme_pass_thru_t *nvme;
+    efi_physical_address_t addr;
+    block_file_t **devs, *dev;
+    __nvmeslot_t s;
+    __nvmeq_t *q;
+    uintn_t i, n = 0, chunk, depth, bsize;
+    uint64_t size;
+    uint32_t nsid, lbaf;
+    uint8_t *id;
+
+    if(EFI_ERROR(BS->LocateHandleBuffer(ByProtocol, &nvmeGuid, NULL, &n, &handles)) || !handles)
+        return;
+    /* identify data is always 4096 bytes */
+    if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, 1, &addr))) {
+        BS->FreePool(handles);
+        return;
+    }
+    id = (uint8_t*)addr;
+    memset(&s, 0, sizeof(__nvmeslot_t));
+    for(i = 0; i < n; i++) {
+        if(!handles[i] || EFI_ERROR(BS->HandleProtocol(handles[i], &nvmeGuid, (void **) &nvme)) || !nvme || !nvme->Mode)
+            continue;
+        /* identify controller for the maximum data transfer size, in units of 4k pages */
+        chunk = __NVME_CHUNK;
+        memset(id, 0, 4096);
+        __nvme_cmd(&s, 0, NVME_ADMIN_QUEUE, __NVME_IDENTIFY, 1, 0, id, 4096);
+        if(!EFI_ERROR(nvme->PassThru(nvme, 0, &s.packet, NULL)) && !EFI_ERROR(__nvme_status(&s)) && id[77] &&
+            id[77] < 16 && (uintn_t)4096 << id[77] < chunk)
+            chunk = (uintn_t)4096 << id[77];
+        depth = nvme->Mode->Attributes & EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_NONBLOCKIO ? UEFI_NVME_DEPTH : 1;
+        for(nsid = 0xFFFFFFFF; !EFI_ERROR(nvme->GetNextNamespace(nvme, &nsid)); ) {
+            memset(id, 0, 4096);
+            __nvme_cmd(&s, nsid, NVME_ADMIN_QUEUE, __NVME_IDENTIFY, 0, 0, id, 4096);
+            if(EFI_ERROR(nvme->PassThru(nvme, nsid, &s.packet, NULL)) || EFI_ERROR(__nvme_status(&s)))
+                continue;
+            /* namespace size in blocks and the LBA format in use: metadata size in bits 0-15, log2 of the block size in
+             * bits 16-23 */
+            memcpy(&size, id, 8);
+            memcpy(&lbaf, id + 128 + (id[26] & 15) * 4, 4);
+            bsize = (lbaf >> 16) & 0xff;
+            if(!size || (lbaf & 0xffff) || bsize < 9 || bsize > 16)
+                continue;
+            bsize = 1 << bsize;
+            if(!(dev = (block_file_t*)malloc(sizeof(block_file_t)))) continue;
+            memset(dev, 0, sizeof(block_file_t));
+            if(!(q = (__nvmeq_t*)malloc(sizeof(__nvmeq_t) + (depth - 1) * sizeof(__nvmeslot_t))) ||
+              !(devs = (block_file_t**)realloc(__nvme_devs, (__nvme_ndevs + 1) * sizeof(block_file_t*)))) {
+                if(q) free(q);
+                free(dev);
+                continue;
+            }
+            memset(q, 0, sizeof(__nvmeq_t) + (depth - 1) * sizeof(__nvmeslot_t));
+            q->depth = depth;
+            q->chunk = chunk > bsize ? chunk / bsize * bsize : bsize;
+            dev->handle = handles[i];
+            dev->nvme = nvme;
+            dev->nsid = nsid;
+            dev->queue = q;
+            dev->media.MediaPresent = 1;
+            dev->media.BlockSize = bsize;
+            dev->media.IoAlign = nvme->Mode->IoAlign;
+            dev->media.LastBlock = size - 1;
+            __nvme_devs = devs;
+            __nvme_devs[__nvme_ndevs++] = dev;
+            __blk_ixstale = 1;
+        }
+    }
+    BS->FreePages(addr, 1);
+    BS->FreePool(handles);
+}
+
+/* free the NVMe devices, the caller has flushed them */
+static void __nvme_free(void)
+{
+    __nvmeq_t *q;
+    uintn_t i;
+    for(i = 0; i < __nvme_ndevs; i++) {
+        q = (__nvmeq_t*)__nvme_devs[i]->queue;
+        if(q->bounce)
+            BS->FreePages((efi_physical_address_t)(uintptr_t)q->bounce, EFI_SIZE_TO_PAGES(q->depth * q->chunk));
+        free(q);
+        __gpt_free(__nvme_devs[i]);
+        free(__nvme_devs[i]);
+    }
+    if(__nvme_devs)
+        free(__nvme_devs);
+    __nvme_devs = NULL;
+    __nvme_ndevs = 0;
+    __blk_ixstale = 1;
+}
+
+/* read a block device, serving sequential reads from the readahead slots and keeping them filled */
+static efi_status_t __blk_read(block_file_t *__dev, off_t __off, uintn_t __n, uint8_t *__buf)
+{
+    __blkra_t *ra = (__blkra_t*)__dev->ahead;
+    efi_physical_address_t addr;
+    efi_status_t status = EFI_SUCCESS;
+    uintn_t bsize = __blk_media(__dev)->BlockSize, l;
+    off_t next;
+    int i, seq;
+
+    if(__dev->cache || (!__dev->bio2 && !__dev->dio2))
+        return __blk_rw(__dev, 0, __off, __n, __buf);
+    if(!ra) {
+        ra = (__blkra_t*)malloc(sizeof(__blkra_t));
+        if(!ra) return __blk_rw(__dev, 0, __off, __n, __buf);
+        memset(ra, 0, sizeof(__blkra_t));
+        ra->mediaid = __blk_media(__dev)->MediaId;
+        __dev->ahead = ra;
+    }
+    if(ra->mediaid != __blk_media(__dev)->MediaId) {
+        __ra_drop(__dev);
+        ra->mediaid = __blk_media(__dev)->MediaId;
+    }
+    seq = __off == ra->next;
+    if(!seq) __ra_drop(__dev);
+    ra->next = __off + __n;
+    for(i = 0; __n && i < __RA_DEPTH; ) {
+        if(!ra->slot[i].len || __off < ra->slot[i].off || __off >= ra->slot[i].off + ra->slot[i].len) { i++; continue; }
+        if(!__ra_wait(&ra->slot[i])) break;
+        l = ra->slot[i].off + ra->slot[i].len - __off;
+        if(l > __n) l = __n;
+        memcpy(__buf, ra->buf + i * ra->chunk + (__off - ra->slot[i].off), l);
+        __off += l; __buf += l; __n -= l;
+        if(__off == ra->slot[i].off + ra->slot[i].len) ra->slot[i].len = 0;
+        i = 0;
+    }
+    if(__n) {
+        status = __blk_raw(__dev, 0, __off, __n, __buf);
+        if(EFI_ERROR(status)) return status;
+    }
+    if(!seq) return status;
+    if(!ra->buf) {
+        ra->chunk = (bsize > __RA_CHUNK ? bsize : __RA_CHUNK) / bsize * bsize;
+        if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(__RA_DEPTH * ra->chunk), &addr)))
+            return status;
+        ra->buf = (uint8_t*)addr;
+    }
+    /* keep the window after this read full */
+    for(i = 0, next = ra->next; i < __RA_DEPTH; i++)
+        if(ra->slot[i].len && ra->slot[i].off + ra->slot[i].len > next) next = ra->slot[i].off + ra->slot[i].len;
+    for(i = 0; i < __RA_DEPTH; i++)
+        if(!ra->slot[i].len) next = __ra_submit(__dev, &ra->slot[i], next);
+    return status;
+}
+
+void __stdio_cleanup(void)
+{
+    uintn_t i;
+#ifdef UEFI_IOSTATS
+    char_t name[24];
+#endif
+    for(i = 0; i < __blk_ndevs; i++) {
+        __blk_flush(__blk_devs[i]);
+        __bc_setup(__blk_devs[i], 0);
+        __ra_free(__blk_devs[i]);
+    }
+    for(i = 0; i < __nvme_ndevs; i++) {
+        __blk_flush(__nvme_devs[i]);
+        __bc_setup(__nvme_devs[i], 0);
+    }
+#ifdef UEFI_IOSTATS
+    __iostat_dump(CL("/dev/serial"), __ser_iostat);
+    for(i = 0; i < __blk_ndevs; i++) {
+        sprintf(name, CL("/dev/disk%d"), (uint64_t)i);
+        __iostat_dump(name, __blk_devs[i]->iostat);
+    }
+    for(i = 0; i < __nvme_ndevs; i++) {
+        sprintf(name, CL("/dev/nvme%d"), (uint64_t)i);
+        __iostat_dump(name, __nvme_devs[i]->iostat);
+    }
+#endif
+    __con_flush(&__con[0]);
+    __con_flush(&__con[1]);
+    __dircache_drop(NULL, NULL);
+    __umount(&__bootvol);
+    __umount(&__tmpvol);
+    __tmpfs_free();
+    while(__arcvols)
+        umount_archive(__arcvols->path);
+    if(__copy_buf) {
+        BS->FreePages((efi_physical_address_t)(uintptr_t)__copy_buf, EFI_SIZE_TO_PAGES(2 * __COPY_CHUNK));
+        __copy_buf = NULL;
+    }
+    if(__vols) {
+        for(i = 0; i < __nvols; i++)
+            __umount(&__vols[i]);
+        free(__vols);
+        __vols = NULL;
+        __nvols = 0;
+    }
+#ifndef UEFI_NO_UTF8
+    if(__argvutf8)
+        BS->FreePool(__argvutf8);
+    __argvutf8 = NULL;
+#endif
+    if(__blk_devs) {
+        for(i = 0; i < __blk_ndevs; i++) {
+            __gpt_free(__blk_devs[i]);
+            free(__blk_devs[i]);
+        }
+        free(__blk_devs);
+        __blk_devs = NULL;
+        __blk_ndevs = 0;
+    }
+    __nvme_free();
+    if(__blk_ix)
+        free(__blk_ix);
+    __blk_ix = NULL;
+    __blk_ixmask = 0;
+}
+
+/* a path as the file protocol wants it, converted into buf (FILENAME_MAX characters) if needed. Names that don't fit are
+ * rejected with ENAMETOOLONG rather than truncated, which could open a different file */
+wchar_t *__stdio_wcname(wchar_t *buf, const char_t *name)
+{
+    size_t n;
+#ifndef UEFI_NO_UTF8
+    int r;
+    for(n = 0; *name; n++, name += r) {
+        if(n >= FILENAME_MAX - 1) { errno = ENAMETOOLONG; return NULL; }
+        if((r = mbtowc(&buf[n], name, 4)) < 1) { errno = EINVAL; return NULL; }
+    }
+    buf[n] = 0;
+    return buf;
+#else
+    (void)buf;
+    for(n = 0; name[n]; n++);
+    if(n >= FILENAME_MAX) { errno = ENAMETOOLONG; return NULL; }
+    return (wchar_t*)name;
+#endif
+}
+
+void __stdio_seterrno(efi_status_t status)
+{
+    switch((int)(status & 0xffff)) {
+        case EFI_WRITE_PROTECTED & 0xffff: errno = EROFS; break;
+        case EFI_ACCESS_DENIED & 0xffff: errno = EACCES; break;
+        case EFI_VOLUME_FULL & 0xffff: errno = ENOSPC; break;
+        case EFI_NOT_FOUND & 0xffff: errno = ENOENT; break;
+        case EFI_NO_MEDIA & 0xffff: errno = ENODEV; break;
+        case EFI_INVALID_PARAMETER & 0xffff: errno = EINVAL; break;
+        default: errno = EIO; break;
+    }
+}
+
+/* returns true for the special streams which aren't FILE objects */
+static int __isdev(FILE *__stream)
+{
+    if(__stream == stdin || __stream == stdout || __stream == stderr || (__ser && __stream == (FILE*)__ser))
+        return 1;
+    return __blk_find(__stream) != NULL;
+}
+
+/* allocate the stream buffer on first use, fall back to unbuffered if we can't */
+static void __fbuf(FILE *__stream)
+{
+    if(__stream->buf || __stream->mode == _IONBF) return;
+    __stream->buf = (uint8_t*)malloc(__stream->bufsiz);
+    if(__stream->buf) __stream->flags |= __F_OWNBUF;
+    else __stream->mode = _IONBF;
+}
+
+/* a mapped stream goes back to reading through the firmware, with a buffer of its own */
+static void __funmap(FILE *__stream)
+{
+    if(__stream->flags & __F_MAPPED) {
+        __stream->buf = NULL;
+        __stream->bufsiz = BUFSIZ;
+        __stream->flags &= ~__F_MAPPED;
+    }
+}
+
+/* write out pending data, or give back the unread read ahead data to the firmware. A mapped stream never moved the
+ * firmware's position, so that's always set */
+static int __fflush(FILE *__stream)
+{
+    efi_status_t status = EFI_SUCCESS;
+    uintn_t bs;
+    if((__stream->flags & __F_WRITE) && __stream->pos) {
+        bs = __stream->pos;
+        status = __IOCALL(__stream->iostat, IOSTAT_WRITE, &bs, __stream->fh->Write(__stream->fh, &bs, __stream->buf));
+        if(!EFI_ERROR(status) && bs < __stream->pos) status = EFI_VOLUME_FULL;
+    } else
+    if((__stream->flags & __F_READ) && (__stream->pos < __stream->len || (__stream->flags & __F_MAPPED))) {
+        status = __IOCALL(__stream->iostat, IOSTAT_OTHER, NULL, __stream->fh->SetPosition(__stream->fh, __stream->off));
+    }
+    __funmap(__stream);
+    __stream->pos = __stream->len = 0;
+    __stream->flags &= ~(__F_READ | __F_WRITE);
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        return -1;
+    }
+    return 0;
+}
+
+int fstat (FILE *__f, struct stat *__buf)
+{
+    block_file_t *dev;
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t info;
+    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    efi_status_t status;
+
+    if(!__f || !__buf) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(__buf, 0, sizeof(struct stat));
+    if(__f == stdin) {
+        __buf->st_mode = S_IREAD | S_IFIFO;
+        return 0;
+    }
+    if(__f == stdout || __f == stderr) {
+        __buf->st_mode = S_IWRITE | S_IFIFO;
+        return 0;
+    }
+    if(__ser && __f == (FILE*)__ser) {
+        __buf->st_mode = S_IREAD | S_IWRITE | S_IFCHR;
+        return 0;
+    }
+    if((dev = __blk_find(__f))) {
+        __buf->st_mode = S_IREAD | S_IWRITE | S_IFBLK;
+        __buf->st_size = __blk_size(dev);
+        __buf->st_blocks = __buf->st_size / __blk_media(__blk_disk(dev))->BlockSize;
+        return 0;
+    }
+    if((__f->flags & __F_WRITE) && __fflush(__f))
+        return -1;
+    status = __IOCALL(__f->iostat, IOSTAT_OTHER, NULL, __f->fh->GetInfo(__f->fh, &infGuid, &fsiz, &info));
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        return -1;
+    }
+    __buf->st_mode = S_IREAD |
+        (info.Attribute & EFI_FILE_READ_ONLY ? 0 : S_IWRITE) |
+        (info.Attribute & EFI_FILE_DIRECTORY ? S_IFDIR : S_IFREG);
+    __buf->st_size = __f->size = (off_t)info.FileSize;
+    __buf->st_blocks = (blkcnt_t)info.PhysicalSize;
+    __buf->st_atime = __mktime_efi(&info.LastAccessTime);
+    __buf->st_mtime = __mktime_efi(&info.ModificationTime);
+    __buf->st_ctime = __mktime_efi(&info.CreateTime);
+    return 0;
+}
+
+/* set the file size through EFI_FILE_INFO, so that the firmware allocates the clusters at once */
+static int __setsize(FILE *__f, off_t __size)
+{
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t info;
+    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    efi_status_t status;
+
+    if(__isdev(__f))
+        return EBADF;
+    if(__f->flags && __fflush(__f))
+        return errno;
+    status = __IOCALL(__f->iostat, IOSTAT_OTHER, NULL, __f->fh->GetInfo(__f->fh, &infGuid, &fsiz, &info));
+    if(!EFI_ERROR(status)) {
+        if(info.Attribute & EFI_FILE_DIRECTORY)
+            return EISDIR;
+        info.FileSize = __size;
+        status = __IOCALL(__f->iostat, IOSTAT_OTHER, NULL, __f->fh->SetInfo(__f->fh, &infGuid, fsiz, &info));
+    }
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        return errno;
+    }
+    __f->size = __size;
+    return 0;
+}
+
+int ftruncate (FILE *__stream, off_t __length)
+{
+    int ret;
+    if(!__stream) {
+        errno = EINVAL;
+        return -1;
+    }
+    if((ret = __setsize(__stream, __length))) {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+int posix_fallocate (FILE *__stream, off_t __offset, off_t __len)
+{
+    if(!__stream || !__len || __offset + __len < __offset)
+        return EINVAL;
+    if(__isdev(__stream))
+        return EBADF;
+    /* the cached size is up to date, there's nothing to do if the file is big enough already */
+    return __offset + __len > __stream->size ? __setsize(__stream, __offset + __len) : 0;
+}
+
+#ifdef UEFI_IOSTATS
+int fiostat (FILE *__stream, iostat_t *__st)
+{
+    block_file_t *dev;
+    iostat_t *st = NULL;
+    if(!__stream || !__st) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(__ser && __stream == (FILE*)__ser)
+        st = __ser_iostat;
+    if((dev = __blk_find(__stream)))
+        st = __blk_disk(dev)->iostat;
+    if(!st && !__isdev(__stream))
+        st = __stream->iostat;
+    if(!st) {
+        errno = EBADF;
+        return -1;
+    }
+    memcpy(__st, st, IOSTAT_MAX * sizeof(iostat_t));
+    return 0;
+}
+#endif
+
+int fclose (FILE *__stream)
+{
+    block_file_t *dev;
+    efi_status_t status = EFI_SUCCESS;
+    int ret;
+    if(!__stream) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(__stream == stdout || __stream == stderr) {
+        __con_flush(&__con[__stream == stderr]);
+        return 1;
+    }
+    if(__stream == stdin || (__ser && __stream == (FILE*)__ser)) {
+        return 1;
+    }
+    if((dev = __blk_find(__stream))) {
+        status = __blk_flush(__blk_disk(dev));
+        if(EFI_ERROR(status)) {
+            __stdio_seterrno(status);
+            return 0;
+        }
+        return 1;
+    }
+    /* the handle is closed even if the buffered data couldn't be written, but that's an error, with errno kept */
+    ret = !__fflush(__stream);
+    status = __IOCALL(__stream->iostat, IOSTAT_OTHER, NULL, __stream->fh->Close(__stream->fh));
+#ifdef UEFI_IOSTATS
+    __iostat_dump(__stream->iostat_name, __stream->iostat);
+#endif
+    if(__stream->flags & __F_OWNBUF)
+        free(__stream->buf);
+    free(__stream);
+    if(ret && EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        ret = 0;
+    }
+    return ret;
+}
+
+int fflush (FILE *__stream)
+{
+    block_file_t *dev;
+    efi_status_t status = EFI_SUCCESS;
+    if(!__stream) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(__stream == stdout || __stream == stderr) {
+        __con_flush(&__con[__stream == stderr]);
+        return 1;
+    }
+    if(__stream == stdin || (__ser && __stream == (FILE*)__ser)) {
+        return 1;
+    }
+    if((dev = __blk_find(__stream))) {
+        status = __blk_flush(__blk_disk(dev));
+        if(EFI_ERROR(status)) {
+            __stdio_seterrno(status);
+            return 0;
+        }
+        return 1;
+    }
+    if(__fflush(__stream))
+        return 0;
+    status = __IOCALL(__stream->iostat, IOSTAT_OTHER, NULL, __stream->fh->Flush(__stream->fh));
+    return !EFI_ERROR(status);
+}
+
+int setvbuf (FILE *__stream, char *__buf, int __modes, size_t __n)
+{
+    block_file_t *dev;
+    __con_t *c;
+    if(!__stream || (__modes != _IOFBF && __modes != _IOLBF && __modes != _IONBF) || (__buf && !__n)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(__stream == stdout || __stream == stderr) {
+        /* console buffers hold UCS-2 characters plus a terminating zero */
+        if(__buf && __n < 4 * sizeof(wchar_t)) {
+            errno = EINVAL;
+            return -1;
+        }
+        c = &__con[__stream == stderr];
+        __con_flush(c);
+        c->buf = __buf ? (wchar_t*)__buf : __con_bufs[__stream == stderr];
+        c->bufsiz = __buf ? __n / sizeof(wchar_t) - 1 : __CON_BUFSIZ;
+        c->mode = __modes;
+        return 0;
+    }
+    /* on disks, the buffer is a block cache of n bytes, allocated by us to meet the media's alignment. Partitions share
+     * the cache of their disk */
+    if((dev = __blk_find(__stream)))
+        return __bc_setup(__blk_disk(dev), __modes == _IONBF ? 0 : (__n ? __n : BUFSIZ));
+    if(__isdev(__stream)) {
+        errno = EBADF;
+        return -1;
+    }
+    if(__fflush(__stream))
+        return -1;
+    if(__stream->flags & __F_OWNBUF)
+        free(__stream->buf);
+    __stream->flags &= ~__F_OWNBUF;
+    __stream->buf = __modes == _IONBF ? NULL : (uint8_t*)__buf;
+    __stream->bufsiz = __n ? __n : BUFSIZ;
+    __stream->mode = __modes;
+    return 0;
+}
+
+void setbuf (FILE *__stream, char *__buf)
+{
+    setvbuf(__stream, __buf, __buf ? _IOFBF : _IONBF, BUFSIZ);
+}
+
+int __remove (const char_t *__filename, int isdir)
+{
+    efi_status_t status;
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t info;
+    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    const char_t *name = __filename;
+    __vol_t *vol;
+#ifndef UEFI_NO_UTF8
+    wchar_t wcname[FILENAME_MAX];
+#else
+    wchar_t *wcname = NULL;
+#endif
+    /* little hack to support read and write mode for Delete() and stat() without create mode or checks */
+    FILE *f = fopen(__filename, CL("*"));
+    if(errno)
+        return 1;
+    if(!f || f == stdin || f == stdout || f == stderr || (__ser && f == (FILE*)__ser)) {
+        errno = EBADF;
+        return 1;
+    }
+    if(__blk_find(f)) {
+        errno = EBADF;
+        return 1;
+    }
+    if(f->flags & __F_RDONLY) {
+        fclose(f);
+        errno = EROFS;
+        return -1;
+    }
+    if(isdir != -1) {
+        status = f->fh->GetInfo(f->fh, &infGuid, &fsiz, &info);
+        if(EFI_ERROR(status)) goto err;
+        if(isdir == 0 && (info.Attribute & EFI_FILE_DIRECTORY)) {
+            fclose(f); errno = EISDIR;
+            return -1;
+        }
+        if(isdir == 1 && !(info.Attribute & EFI_FILE_DIRECTORY)) {
+            fclose(f); errno = ENOTDIR;
+            return -1;
+        }
+    }
+    /* a deleted directory must not stay in the handle cache */
+    vol = __getvol(&name);
+    __dircache_drop(vol, __stdio_wcname(wcname, name));
+    status = f->fh->Delete(f->fh);
+    /* the handle is closed, but the file is still there, like a non-empty directory */
+    if(status == EFI_WARN_DELETE_FAILURE) {
+        free(f);
+        errno = isdir == 1 ? ENOTEMPTY : EACCES;
+        return -1;
+    }
+    if(EFI_ERROR(status)) {
+err:    __stdio_seterrno(status);
+        fclose(f);
+        return -1;
+    }
+    /* no need for fclose(f); */
+    free(f);
+    return 0;
+}
+
+int remove (const char_t *__filename)
+{
+    return __remove(__filename, -1);
+}
+
+#define __badmode(m) (!(m) || ((m)[0] != CL('r') && (m)[0] != CL('w') && (m)[0] != CL('a') && (m)[0] != CL('*')) || \
+    ((m)[1] != 0 && (m)[1] != CL('d') && (m)[1] != CL('+')))
+
+/* open a real file, relative to dir or from the root directory of vol if dir is NULL */
+static FILE *__fopen (__vol_t *__vol, efi_file_handle_t *__dir, const char_t *__filename, const char_t *__modes)
+{
+    FILE *ret;
+    efi_status_t status;
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t info;
+    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    uint64_t mode, attr;
+    wchar_t *name;
+#ifndef UEFI_NO_UTF8
+    wchar_t wcname[FILENAME_MAX];
+#else
+    wchar_t *wcname = NULL;
+#endif
+    if(!(name = __stdio_wcname(wcname, __filename))) return NULL;
+    ret = (FILE*)malloc(sizeof(FILE));
+    if(!ret) return NULL;
+    memset(ret, 0, sizeof(FILE));
+    ret->bufsiz = BUFSIZ;
+    ret->mode = _IOFBF;
+    /* normally write means read,write,create. But for remove (internal '*' mode), we need read,write without create
+     * also mode 'w' in POSIX means write-only (without read), but that's not working on certain firmware, we must
+     * pass read too. This poses a problem of truncating a write-only file, see issue #26, we have to do that manually */
+    mode = __modes[0] == CL('w') || __modes[0] == CL('a') ? (EFI_FILE_MODE_WRITE | EFI_FILE_MODE_READ | EFI_FILE_MODE_CREATE) :
+        EFI_FILE_MODE_READ | (__modes[0] == CL('*') || __modes[1] == CL('+') ? EFI_FILE_MODE_WRITE : 0);
+    if(!(mode & EFI_FILE_MODE_WRITE)) ret->flags |= __F_RDONLY;
+    attr = __modes[1] == CL('d') ? EFI_FILE_DIRECTORY : 0;
+    status = __IOCALL(ret->iostat, IOSTAT_OTHER, NULL, __dir ? __dir->Open(__dir, &ret->fh, name, mode, attr) :
+        __openpath(__vol, &ret->fh, name, mode, attr));
+    /* stat works on write protected media too, remove will tell that it's read-only */
+    if(__modes[0] == CL('*') && (status & 0xffff) == (EFI_WRITE_PROTECTED & 0xffff)) {
+        mode = EFI_FILE_MODE_READ;
+        ret->flags |= __F_RDONLY;
+        status = __IOCALL(ret->iostat, IOSTAT_OTHER, NULL, __dir ? __dir->Open(__dir, &ret->fh, name, mode, attr) :
+            __openpath(__vol, &ret->fh, name, mode, attr));
+    }
+#ifdef UEFI_IOSTATS
+    /* keep the end of the name, that's the more telling part */
+    fsiz = strlen(__filename);
+    strncpy(ret->iostat_name, __filename + (fsiz > 31 ? fsiz - 31 : 0), 31);
+    fsiz = (uintn_t)sizeof(efi_file_info_t);
+#endif
+    if(EFI_ERROR(status)) {
+err:    __stdio_seterrno(status);
+        free(ret); return NULL;
+    }
+    if(__modes[0] == CL('*')) return ret;
+    status = __IOCALL(ret->iostat, IOSTAT_OTHER, NULL, ret->fh->GetInfo(ret->fh, &infGuid, &fsiz, &info));
+    if(EFI_ERROR(status)) {
+        ret->fh->Close(ret->fh); goto err;
+    }
+    if(__modes[1] == CL('d') && !(info.Attribute & EFI_FILE_DIRECTORY)) {
+        ret->fh->Close(ret->fh); free(ret); errno = ENOTDIR; return NULL;
+    }
+    if(__modes[1] != CL('d') && (info.Attribute & EFI_FILE_DIRECTORY)) {
+        ret->fh->Close(ret->fh); free(ret); errno = EISDIR; return NULL;
+    }
+    ret->size = (off_t)info.FileSize;
+    /* files in a mounted archive are already in memory, so the stream buffer is the file itself */
+    if(__modes[0] == CL('r') && (ret->buf = (uint8_t*)__archive_data(ret->fh))) {
+        ret->bufsiz = ret->len = (size_t)ret->size;
+        ret->flags |= __F_READ | __F_MAPPED;
+    }
+    if(__modes[0] == CL('a')) fseek(ret, 0, SEEK_END);
+    if(__modes[0] == CL('w')) {
+        /* manually truncate file size
+         * See https://github.com/tianocore/edk2/blob/master/MdePkg/Library/UefiFileHandleLib/UefiFileHandleLib.c
+         * function FileHandleSetSize */
+        info.FileSize = 0;
+        __IOCALL(ret->iostat, IOSTAT_OTHER, NULL, ret->fh->SetInfo(ret->fh, &infGuid, fsiz, &info));
+        ret->size = 0;
+    }
+    return ret;
+}
+
+FILE *fopen (const char_t *__filename, const char_t *__modes)
+{
+    efi_status_t status;
+    __vol_t *vol;
+    block_file_t *dev;
+    uintn_t par, i;
+    errno = 0;
+    if(!__filename || !*__filename || __badmode(__modes)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    /* fake some device names. UEFI has no concept of device files */
+    if(!strcmp(__filename, CL("/dev/stdin"))) {
+        if(__modes[0] == CL('w') || __modes[0] == CL('a')) { errno = EPERM; return NULL; }
+        return stdin;
+    }
+    if(!strcmp(__filename, CL("/dev/stdout"))) {
+        if(__modes[0] == CL('r')) { errno = EPERM; return NULL; }
+        return stdout;
+    }
+    if(!strcmp(__filename, CL("/dev/stderr"))) {
+        if(__modes[0] == CL('r')) { errno = EPERM; return NULL; }
+        return stderr;
+    }
+    if(!memcmp(__filename, CL("/dev/serial"), 11 * sizeof(char_t))) {
+        par = (uintn_t)atol(__filename + 11);
+        if(!__ser) {
+            efi_guid_t serGuid = EFI_SERIAL_IO_PROTOCOL_GUID;
+            status = BS->LocateProtocol(&serGuid, NULL, (void**)&__ser);
+            if(EFI_ERROR(status) || !__ser) { errno = ENOENT; return NULL; }
+        }
+        __ser->SetAttributes(__ser, par > 9600 ? par : 115200, 0, 1000, NoParity, 8, OneStopBit);
+        return (FILE*)__ser;
+    }
+    if(!memcmp(__filename, CL("/dev/disk"), 9 * sizeof(char_t))) {
+        par = (uintn_t)atol(__filename + 9);
+        if(!__blk_devs || __blk_stale)
+            __blk_enum();
+        if(par < __blk_ndevs) {
+            /* /dev/diskNpM is partition M of disk N */
+            for(i = 9; __filename[i] >= CL('0') && __filename[i] <= CL('9'); i++);
+            if(__filename[i] != CL('p'))
+                return (FILE*)__blk_devs[par]->bio;
+            if((dev = __blk_part(__blk_devs[par], (uintn_t)atol(__filename + i + 1))))
+                return (FILE*)dev;
+        }
+        errno = ENOENT;
+        return NULL;
+    }
+    if(!memcmp(__filename, CL("/dev/nvme"), 9 * sizeof(char_t))) {
+        par = (uintn_t)atol(__filename + 9);
+        if(!__nvme_devs)
+            __nvme_enum();
+        if(par < __nvme_ndevs) {
+            for(i = 9; __filename[i] >= CL('0') && __filename[i] <= CL('9'); i++);
+            if(__filename[i] != CL('p'))
+                return (FILE*)__nvme_devs[par];
+            if((dev = __blk_part(__nvme_devs[par], (uintn_t)atol(__filename + i + 1))))
+                return (FILE*)dev;
+        }
+        errno = ENOENT;
+        return NULL;
+    }
+    if(!(vol = __getvol(&__filename)))
+        return NULL;
+    return __fopen(vol, NULL, __filename, __modes);
+}
+
+FILE *fopenat (DIR *__dirp, const char_t *__filename, const char_t *__modes)
+{
+    if(!__dirp)
+        return fopen(__filename, __modes);
+    errno = 0;
+    if(!__filename || !*__filename || __badmode(__modes)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return __fopen(NULL, __dirp, __filename, __modes);
+}
+
+size_t fread (void *__ptr, size_t __size, size_t __n, FILE *__stream)
+{
+    block_file_t *dev;
+    uintn_t bs = __size * __n, i, n;
+    uint8_t *dst = (uint8_t*)__ptr;
+    efi_status_t status;
+    if(!__ptr || __size < 1 || __n < 1 || !__stream) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(__stream == stdin || __stream == stdout || __stream == stderr) {
+        errno = ESPIPE;
+        return 0;
+    }
+    if(__ser && __stream == (FILE*)__ser) {
+        status = __IOCALL(__ser_iostat, IOSTAT_READ, &bs, __ser->Read(__ser, &bs, __ptr));
+    } else {
+        if((dev = __blk_find(__stream))) {
+            n = __blk_unit(__blk_disk(dev));
+            /* stay within the disk or the partition */
+            if(bs > __blk_size(dev) - dev->offset)
+                bs = dev->offset < __blk_size(dev) ? __blk_size(dev) - dev->offset : 0;
+            bs = (bs / n) * n;
+            if(!bs) return 0;
+            status = __blk_read(__blk_disk(dev), dev->start + dev->offset, bs, __ptr);
+            if(EFI_ERROR(status)) {
+                __stdio_seterrno(status);
+                return 0;
+            }
+            dev->offset += bs;
+            return bs / __size;
+        }
+        if((__stream->flags & __F_WRITE) && __fflush(__stream))
+            return 0;
+        __fbuf(__stream);
+        status = EFI_SUCCESS;
+        for(n = bs; n; ) {
+            /* serve from the read ahead buffer first */
+            if(__stream->pos < __stream->len) {
+                i = __stream->len - __stream->pos;
+                if(i > n) i = n;
+                memcpy(dst, __stream->buf + __stream->pos, i);
+                __stream->pos += i; __stream->off += i; dst += i; n -= i;
+                continue;
+            }
+            /* the mapped buffer is the whole file */
+            if(__stream->flags & __F_MAPPED)
+                break;
+            /* big reads go directly into the caller's buffer. The old read ahead data doesn't belong to the new position,
+             * fseek must not find it */
+            if(!__stream->buf || n >= __stream->bufsiz) {
+                __stream->pos = __stream->len = 0;
+                __stream->flags &= ~__F_READ;
+                bs = n;
+                status = __IOCALL(__stream->iostat, IOSTAT_READ, &bs, __stream->fh->Read(__stream->fh, &bs, dst));
+                if(!EFI_ERROR(status)) {
+                    dst += bs; __stream->off += bs;
+                    /* a short read means we've found the end of the file */
+                    if(bs < n || __stream->off > __stream->size) __stream->size = __stream->off;
+                }
+                break;
+            }
+            bs = __stream->bufsiz;
+            status = __IOCALL(__stream->iostat, IOSTAT_READ, &bs, __stream->fh->Read(__stream->fh, &bs, __stream->buf));
+            if(EFI_ERROR(status)) break;
+            if(bs < __stream->bufsiz || __stream->off + bs > __stream->size) __stream->size = __stream->off + bs;
+            if(!bs) break;
+            __stream->pos = 0;
+            __stream->len = bs;
+            __stream->flags |= __F_READ;
+        }
+        bs = (uintn_t)(dst - (uint8_t*)__ptr);
+    }
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        return 0;
+    }
+    return bs / __size;
+}
+
+size_t fwrite (const void *__ptr, size_t __size, size_t __n, FILE *__stream)
+{
+    block_file_t *dev;
+    uintn_t bs = __size * __n, n;
+    efi_status_t status;
+    if(!__ptr || __size < 1 || __n < 1 || !__stream) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(__stream == stdin || __stream == stdout || __stream == stderr) {
+        errno = ESPIPE;
+        return 0;
+    }
+    if(__ser && __stream == (FILE*)__ser) {
+        status = __IOCALL(__ser_iostat, IOSTAT_WRITE, &bs, __ser->Write(__ser, &bs, (void*)__ptr));
+    } else {
+        if((dev = __blk_find(__stream))) {
+            n = __blk_unit(__blk_disk(dev));
+            if(bs > __blk_size(dev) - dev->offset)
+                bs = dev->offset < __blk_size(dev) ? __blk_size(dev) - dev->offset : 0;
+            bs = (bs / n) * n;
+            if(!bs) return 0;
+            status = __blk_rw(__blk_disk(dev), 1, dev->start + dev->offset, bs, (void*)__ptr);
+            if(EFI_ERROR(status)) {
+                __stdio_seterrno(status);
+                return 0;
+            }
+            dev->offset += bs;
+            return bs / __size;
+        }
+        /* don't buffer what could never be written */
+        if(__stream->flags & __F_RDONLY) {
+            errno = EBADF;
+            return 0;
+        }
+        if((__stream->flags & __F_READ) && __fflush(__stream))
+            return 0;
+        __fbuf(__stream);
+        /* collect small writes in the buffer, big ones go directly to the firmware */
+        if(__stream->buf && bs < __stream->bufsiz) {
+            if(__stream->pos + bs > __stream->bufsiz && __fflush(__stream))
+                return 0;
+            memcpy(__stream->buf + __stream->pos, __ptr, bs);
+            __stream->pos += bs;
+            __stream->off += bs;
+            if(__stream->off > __stream->size) __stream->size = __stream->off;
+            __stream->flags |= __F_WRITE;
+            if(__stream->mode == _IOLBF && memchr(__ptr, '\n', bs) && __fflush(__stream))
+                return 0;
+            return __n;
+        }
+        if((__stream->flags & __F_WRITE) && __fflush(__stream))
+            return 0;
+        status = __IOCALL(__stream->iostat, IOSTAT_WRITE, &bs, __stream->fh->Write(__stream->fh, &bs, (void *)__ptr));
+        if(!EFI_ERROR(status)) {
+            __stream->off += bs;
+            if(__stream->off > __stream->size) __stream->size = __stream->off;
+        }
+    }
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        return 0;
     }
+    return bs / __size;
 }
 
-int fstat (FILE *__f, struct stat *__buf)
+int fseek (FILE *__stream, long int __off, int __whence)
 {
-    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
-    efi_file_info_t info;
-    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    block_file_t *dev;
+    off_t off = 0, start;
     efi_status_t status;
-    uintn_t i;
-
-    if(!__f || !__buf) {
+    if(!__stream || (__whence != SEEK_SET && __whence != SEEK_CUR && __whence != SEEK_END)) {
         errno = EINVAL;
         return -1;
     }
-    memset(__buf, 0, sizeof(struct stat));
-    if(__f == stdin) {
-        __buf->st_mode = S_IREAD | S_IFIFO;
-        return 0;
+    if(__stream == stdin || __stream == stdout || __stream == stderr) {
+        errno = ESPIPE;
+        return -1;
     }
-    if(__f == stdout || __f == stderr) {
-        __buf->st_mode = S_IWRITE | S_IFIFO;
-        return 0;
+    if(__ser && __stream == (FILE*)__ser) {
+        errno = EBADF;
+        return -1;
     }
-    if(__ser && __f == (FILE*)__ser) {
-        __buf->st_mode = S_IREAD | S_IWRITE | S_IFCHR;
+    if((dev = __blk_find(__stream))) {
+        /* the start of the last block, like with files */
+        off = __blk_size(dev) - __blk_media(__blk_disk(dev))->BlockSize;
+        switch(__whence) {
+            case SEEK_END:
+                dev->offset = off + __off;
+                break;
+            case SEEK_CUR:
+                dev->offset += __off;
+                break;
+            case SEEK_SET:
+                dev->offset = __off;
+                break;
+        }
+        if(dev->offset < 0) dev->offset = 0;
+        if(dev->offset > off) dev->offset = off;
+        dev->offset = (dev->offset / __blk_unit(__blk_disk(dev))) * __blk_unit(__blk_disk(dev));
         return 0;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__f == (FILE*)__blk_devs[i].bio) {
-            __buf->st_mode = S_IREAD | S_IWRITE | S_IFBLK;
-            __buf->st_size = (off_t)__blk_devs[i].bio->Media->BlockSize * ((off_t)__blk_devs[i].bio->Media->LastBlock + 1);
-            __buf->st_blocks = __blk_devs[i].bio->Media->LastBlock + 1;
+    switch(__whence) {
+        case SEEK_END: off = __stream->size + __off; break;
+        case SEEK_CUR: off = __stream->off + __off; break;
+        default: off = __off; break;
+    }
+    /* seeking within the read ahead buffer doesn't need the firmware */
+    if(__stream->flags & __F_READ) {
+        start = __stream->off - __stream->pos;
+        if(off >= start && off <= start + __stream->len) {
+            __stream->pos = off - start;
+            __stream->off = off;
             return 0;
         }
-    status = __f->GetInfo(__f, &infGuid, &fsiz, &info);
+        __funmap(__stream);
+        __stream->pos = __stream->len = 0;
+        __stream->flags &= ~__F_READ;
+    } else
+    if(__fflush(__stream))
+        return -1;
+    status = __IOCALL(__stream->iostat, IOSTAT_OTHER, NULL, __stream->fh->SetPosition(__stream->fh, off));
     if(EFI_ERROR(status)) {
         __stdio_seterrno(status);
         return -1;
     }
-    __buf->st_mode = S_IREAD |
-        (info.Attribute & EFI_FILE_READ_ONLY ? 0 : S_IWRITE) |
-        (info.Attribute & EFI_FILE_DIRECTORY ? S_IFDIR : S_IFREG);
-    __buf->st_size = (off_t)info.FileSize;
-    __buf->st_blocks = (blkcnt_t)info.PhysicalSize;
-    __buf->st_atime = __mktime_efi(&info.LastAccessTime);
-    __buf->st_mtime = __mktime_efi(&info.ModificationTime);
-    __buf->st_ctime = __mktime_efi(&info.CreateTime);
+    __stream->off = off;
     return 0;
 }
 
-int fclose (FILE *__stream)
+long int ftell (FILE *__stream)
 {
-    efi_status_t status = EFI_SUCCESS;
-    uintn_t i;
+    block_file_t *dev;
     if(!__stream) {
         errno = EINVAL;
-        return 0;
+        return -1;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr || (__ser && __stream == (FILE*)__ser)) {
-        return 1;
+    if(__stream == stdin || __stream == stdout || __stream == stderr) {
+        errno = ESPIPE;
+        return -1;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio)
-            return 1;
-    status = __stream->Close(__stream);
-    free(__stream);
-    return !EFI_ERROR(status);
+    if(__ser && __stream == (FILE*)__ser) {
+        errno = EBADF;
+        return -1;
+    }
+    if((dev = __blk_find(__stream))) {
+        return (long int)dev->offset;
+    }
+    return (long int)__stream->off;
 }
 
-int fflush (FILE *__stream)
+int feof (FILE *__stream)
 {
-    efi_status_t status = EFI_SUCCESS;
-    uintn_t i;
+    block_file_t *dev;
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t info;
+    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t);
+    efi_status_t status;
     if(!__stream) {
         errno = EINVAL;
         return 0;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr || (__ser && __stream == (FILE*)__ser)) {
-        return 1;
+    if(__stream == stdin || __stream == stdout || __stream == stderr) {
+        errno = ESPIPE;
+        return 0;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio) {
-            return 1;
-        }
-    status = __stream->Flush(__stream);
-    return !EFI_ERROR(status);
-}
-
-int __remove (const char_t *__filename, int isdir)
-{
-    efi_status_t status;
-    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
-    efi_file_info_t info;
-    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t), i;
-    /* little hack to support read and write mode for Delete() and stat() without create mode or checks */
-    FILE *f = fopen(__filename, CL("*"));
-    if(errno)
-        return 1;
-    if(!f || f == stdin || f == stdout || f == stderr || (__ser && f == (FILE*)__ser)) {
+    if(__ser && __stream == (FILE*)__ser) {
         errno = EBADF;
-        return 1;
+        return 0;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(f == (FILE*)__blk_devs[i].bio) {
-            errno = EBADF;
-            return 1;
-        }
-    if(isdir != -1) {
-        status = f->GetInfo(f, &infGuid, &fsiz, &info);
-        if(EFI_ERROR(status)) goto err;
-        if(isdir == 0 && (info.Attribute & EFI_FILE_DIRECTORY)) {
-            fclose(f); errno = EISDIR;
-            return -1;
-        }
-        if(isdir == 1 && !(info.Attribute & EFI_FILE_DIRECTORY)) {
-            fclose(f); errno = ENOTDIR;
-            return -1;
-        }
+    if((dev = __blk_find(__stream))) {
+        errno = EBADF;
+        return dev->offset == __blk_size(dev) - __blk_media(__blk_disk(dev))->BlockSize;
     }
-    status = f->Delete(f);
+    if(__stream->off < __stream->size)
+        return 0;
+    /* at the cached end, check if the file has grown since */
+    if((__stream->flags & __F_WRITE) && __fflush(__stream))
+        return 1;
+    status = __IOCALL(__stream->iostat, IOSTAT_OTHER, NULL, __stream->fh->GetInfo(__stream->fh, &infGuid, &fsiz, &info));
     if(EFI_ERROR(status)) {
-err:    __stdio_seterrno(status);
-        fclose(f);
-        return -1;
+        __stdio_seterrno(status);
+        return 1;
     }
-    /* no need for fclose(f); */
-    free(f);
-    return 0;
+    __stream->size = (off_t)info.FileSize;
+    return __stream->off >= __stream->size;
 }
 
-int remove (const char_t *__filename)
+int fgetc (FILE *__stream)
 {
-    return __remove(__filename, -1);
+    uint8_t c;
+    int k;
+    if(!__stream) {
+        errno = EINVAL;
+        return EOF;
+    }
+    if(__stream == stdin) {
+        k = getchar();
+        return k == L'\r' ? '\n' : k;
+    }
+    if(__stream == stdout || __stream == stderr) {
+        errno = EBADF;
+        return EOF;
+    }
+    if(!__isdev(__stream) && __stream->pos < __stream->len) {
+        __stream->off++;
+        return __stream->buf[__stream->pos++];
+    }
+    return fread(&c, 1, 1, __stream) ? (int)c : EOF;
 }
 
-FILE *fopen (const char_t *__filename, const char_t *__modes)
+char_t *fgets (char_t *__s, int __n, FILE *__stream)
 {
-    FILE *ret;
-    efi_status_t status;
-    efi_guid_t sfsGuid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
-    efi_simple_file_system_protocol_t *sfs = NULL;
-    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
-    efi_file_info_t info;
-    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t), par, i;
-#ifndef UEFI_NO_UTF8
-    wchar_t wcname[BUFSIZ];
+    int i = 0, c;
+#ifdef UEFI_NO_UTF8
+    wchar_t w;
 #endif
-    errno = 0;
-    if(!__filename || !*__filename || !__modes || (__modes[0] != CL('r') && __modes[0] != CL('w') && __modes[0] != CL('a') &&
-      __modes[0] != CL('*')) || (__modes[1] != 0 && __modes[1] != CL('d') && __modes[1] != CL('+'))) {
+    if(!__s || __n < 1 || !__stream) {
         errno = EINVAL;
         return NULL;
     }
-    /* fake some device names. UEFI has no concept of device files */
-    if(!strcmp(__filename, CL("/dev/stdin"))) {
-        if(__modes[0] == CL('w') || __modes[0] == CL('a')) { errno = EPERM; return NULL; }
-        return stdin;
+    while(i < __n - 1) {
+#ifndef UEFI_NO_UTF8
+        c = fgetc(__stream);
+#else
+        if(__isdev(__stream)) c = fgetc(__stream);
+        else c = fread(&w, sizeof(wchar_t), 1, __stream) ? (int)w : EOF;
+#endif
+        if(c == EOF) break;
+        __s[i++] = (char_t)c;
+        if(c == CL('\n')) break;
     }
-    if(!strcmp(__filename, CL("/dev/stdout"))) {
-        if(__modes[0] == CL('r')) { errno = EPERM; return NULL; }
-        return stdout;
+    __s[i] = 0;
+    return i ? __s : NULL;
+}
+
+int fputc (int __c, FILE *__stream)
+{
+    uint8_t c = (uint8_t)__c;
+    wchar_t tmp[2];
+    __con_t *con;
+    if(!__stream) {
+        errno = EINVAL;
+        return EOF;
     }
-    if(!strcmp(__filename, CL("/dev/stderr"))) {
-        if(__modes[0] == CL('r')) { errno = EPERM; return NULL; }
-        return stderr;
+    if(__stream == stdout || __stream == stderr) {
+        con = &__con[__stream == stderr];
+        tmp[0] = L'\r';
+        tmp[1] = (wchar_t)__c;
+        __con_write(con, __c == L'\n' ? tmp : tmp + 1, __c == L'\n' ? 2 : 1);
+        if(con->mode == _IONBF) __con_flush(con);
+        return __c;
     }
-    if(!memcmp(__filename, CL("/dev/serial"), 11 * sizeof(char_t))) {
-        par = (uintn_t)atol(__filename + 11);
-        if(!__ser) {
-            efi_guid_t serGuid = EFI_SERIAL_IO_PROTOCOL_GUID;
-            status = BS->LocateProtocol(&serGuid, NULL, (void**)&__ser);
-            if(EFI_ERROR(status) || !__ser) { errno = ENOENT; return NULL; }
-        }
-        __ser->SetAttributes(__ser, par > 9600 ? par : 115200, 0, 1000, NoParity, 8, OneStopBit);
-        return (FILE*)__ser;
+    if(__stream == stdin) {
+        errno = EBADF;
+        return EOF;
     }
-    if(!memcmp(__filename, CL("/dev/disk"), 9 * sizeof(char_t))) {
-        par = (uintn_t)atol(__filename + 9);
-        if(!__blk_ndevs) {
-            efi_guid_t bioGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
-            efi_handle_t handles[128];
-            uintn_t handle_size = sizeof(handles);
-            status = BS->LocateHandle(ByProtocol, &bioGuid, NULL, &handle_size, (efi_handle_t*)&handles);
-            if(!EFI_ERROR(status)) {
-                handle_size /= (uintn_t)sizeof(efi_handle_t);
-                /* workaround a bug in TianoCore, it reports zero size even though the data is in the buffer */
-                if(handle_size < 1)
-                    handle_size = (uintn_t)sizeof(handles) / sizeof(efi_handle_t);
-                __blk_devs = (block_file_t*)malloc(handle_size * sizeof(block_file_t));
-                if(__blk_devs) {
-                    memset(__blk_devs, 0, handle_size * sizeof(block_file_t));
-                    for(i = __blk_ndevs = 0; i < handle_size; i++)
-                        if(handles[i] && !EFI_ERROR(BS->HandleProtocol(handles[i], &bioGuid, (void **) &__blk_devs[__blk_ndevs].bio)) &&
-                            __blk_devs[__blk_ndevs].bio && __blk_devs[__blk_ndevs].bio->Media &&
-                            __blk_devs[__blk_ndevs].bio->Media->BlockSize > 0)
-                                __blk_ndevs++;
-                } else
-                    __blk_ndevs = 0;
+    if(!__isdev(__stream) && (__stream->flags & __F_WRITE) && __stream->pos < __stream->bufsiz &&
+      (__stream->mode == _IOFBF || c != '\n')) {
+        __stream->buf[__stream->pos++] = c;
+        if(++__stream->off > __stream->size) __stream->size = __stream->off;
+        return c;
+    }
+    return fwrite(&c, 1, 1, __stream) ? (int)c : EOF;
+}
+
+int fputs (const char_t *__s, FILE *__stream)
+{
+    size_t n;
+    if(!__s || !__stream) {
+        errno = EINVAL;
+        return EOF;
+    }
+    if(__isdev(__stream))
+        return fprintf(__stream, CL("%s"), __s) < 0 ? EOF : 0;
+    n = strlen(__s);
+    return !n || fwrite(__s, sizeof(char_t), n, __stream) == n ? 0 : EOF;
+}
+
+/* scatter-gather I/O on block devices. At least block sized pieces at the right alignment are transferred directly,
+ * everything else is collected in a page aligned bounce buffer, so that the firmware gets as few calls as possible */
+
+static ssize_t __blk_iov(block_file_t *__dev, const struct iovec *__iov, int __iovcnt, int __write)
+{
+    efi_status_t status = EFI_SUCCESS;
+    efi_physical_address_t addr = 0;
+    block_file_t *disk = __blk_disk(__dev);
+    off_t off = __dev->start + __dev->offset, end = __blk_size(__dev);
+    uintn_t bsize = __blk_media(disk)->BlockSize, unit = __blk_unit(disk), bounce;
+    uintn_t align = unit > 1 && disk->media.IoAlign > 1 ? disk->media.IoAlign : 1;
+    size_t total = 0, left, len, n, fill = 0, bpos = 0, done = 0;
+    uint8_t *buf = NULL, *p;
+    int i;
+
+    bounce = (bsize > __BOUNCE_SIZE ? bsize : __BOUNCE_SIZE) / bsize * bsize;
+    for(i = 0; i < __iovcnt; i++)
+        total += __iov[i].iov_len;
+    /* stay within the disk or the partition */
+    if(total > end - __dev->offset)
+        total = __dev->offset < end ? end - __dev->offset : 0;
+    /* like fread and fwrite, the size is truncated to the block size without Disk IO */
+    left = total / unit * unit;
+    for(i = 0; i < __iovcnt; i++)
+        for(p = (uint8_t*)__iov[i].iov_base, len = __iov[i].iov_len; len && (left || (!__write && fill > bpos)); ) {
+            if(fill == bpos && len >= bsize && !((uintptr_t)p % align)) {
+                n = len / unit * unit;
+                if(n > left) n = left;
+                status = __blk_rw(disk, __write, off, n, p);
+                if(EFI_ERROR(status)) goto end;
+                off += n; left -= n; done += n; p += n; len -= n;
+                continue;
+            }
+            if(!buf) {
+                status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(bounce), &addr);
+                if(EFI_ERROR(status)) goto end;
+                buf = (uint8_t*)addr;
+            }
+            if(__write) {
+                n = bounce - fill;
+                if(n > len) n = len;
+                if(n > left - fill) n = left - fill;
+                memcpy(buf + fill, p, n);
+                fill += n; p += n; len -= n;
+                if(fill == bounce || fill == left) {
+                    status = __blk_rw(disk, 1, off, fill, buf);
+                    if(EFI_ERROR(status)) goto end;
+                    off += fill; left -= fill; done += fill; fill = 0;
+                }
+            } else {
+                if(fill == bpos) {
+                    fill = left < bounce ? left : bounce;
+                    status = __blk_rw(disk, 0, off, fill, buf);
+                    if(EFI_ERROR(status)) { fill = 0; goto end; }
+                    off += fill; left -= fill; bpos = 0;
+                }
+                n = fill - bpos;
+                if(n > len) n = len;
+                memcpy(p, buf + bpos, n);
+                bpos += n; done += n; p += n; len -= n;
             }
         }
-        if(__blk_ndevs && par < __blk_ndevs)
-            return (FILE*)__blk_devs[par].bio;
-        errno = ENOENT;
-        return NULL;
+end:
+    if(buf)
+        BS->FreePages(addr, EFI_SIZE_TO_PAGES(bounce));
+    __dev->offset += __write ? done : done + fill - bpos;
+    if(EFI_ERROR(status)) {
+        __stdio_seterrno(status);
+        if(!done) return -1;
     }
-    if(!__root_dir && LIP) {
-        status = BS->HandleProtocol(LIP->DeviceHandle, &sfsGuid, (void **)&sfs);
-        if(!EFI_ERROR(status))
-            status = sfs->OpenVolume(sfs, &__root_dir);
+    return (ssize_t)done;
+}
+
+ssize_t readv (FILE *__stream, const struct iovec *__iov, int __iovcnt)
+{
+    block_file_t *dev;
+    ssize_t ret = 0;
+    size_t n;
+    int i;
+    if(!__stream || !__iov || __iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if((dev = __blk_find(__stream)))
+        return __blk_iov(dev, __iov, __iovcnt, 0);
+    /* small pieces are served from the read ahead buffer, big ones are read directly */
+    errno = 0;
+    for(i = 0; i < __iovcnt; i++) {
+        if(!__iov[i].iov_len) continue;
+        n = fread(__iov[i].iov_base, 1, __iov[i].iov_len, __stream);
+        ret += (ssize_t)n;
+        if(n < __iov[i].iov_len) break;
+    }
+    return !ret && errno ? -1 : ret;
+}
+
+ssize_t writev (FILE *__stream, const struct iovec *__iov, int __iovcnt)
+{
+    block_file_t *dev;
+    ssize_t ret = 0;
+    size_t n;
+    int i;
+    if(!__stream || !__iov || __iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if((dev = __blk_find(__stream)))
+        return __blk_iov(dev, __iov, __iovcnt, 1);
+    /* small pieces are merged in the stream's buffer, big ones are written directly */
+    errno = 0;
+    for(i = 0; i < __iovcnt; i++) {
+        if(!__iov[i].iov_len) continue;
+        n = fwrite(__iov[i].iov_base, 1, __iov[i].iov_len, __stream);
+        ret += (ssize_t)n;
+        if(n < __iov[i].iov_len) break;
     }
-    if(!__root_dir) {
-        errno = ENODEV;
+    return !ret && errno ? -1 : ret;
+}
+
+/* load a whole file into freshly allocated pages. Reads go straight into the pages in big chunks, because a single
+ * huge Read is slow or even fails with certain FAT drivers */
+#define __MAP_CHUNK (1024 * 1024)
+
+void *map_file (const char_t *__filename, size_t *__size)
+{
+    FILE *f;
+    efi_status_t status;
+    efi_physical_address_t addr = 0;
+    uintn_t pages, n;
+    size_t size, pos;
+    if(!__size) {
+        errno = EINVAL;
         return NULL;
     }
-    ret = (FILE*)malloc(sizeof(FILE));
-    if(!ret) return NULL;
-    /* normally write means read,write,create. But for remove (internal '*' mode), we need read,write without create
-     * also mode 'w' in POSIX means write-only (without read), but that's not working on certain firmware, we must
-     * pass read too. This poses a problem of truncating a write-only file, see issue #26, we have to do that manually */
-#ifndef UEFI_NO_UTF8
-    mbstowcs((wchar_t*)&wcname, __filename, BUFSIZ - 1);
-    status = __root_dir->Open(__root_dir, &ret, (wchar_t*)&wcname,
-#else
-    status = __root_dir->Open(__root_dir, &ret, (wchar_t*)__filename,
-#endif
-        __modes[0] == CL('w') || __modes[0] == CL('a') ? (EFI_FILE_MODE_WRITE | EFI_FILE_MODE_READ | EFI_FILE_MODE_CREATE) :
-            EFI_FILE_MODE_READ | (__modes[0] == CL('*') || __modes[1] == CL('+') ? EFI_FILE_MODE_WRITE : 0),
-        __modes[1] == CL('d') ? EFI_FILE_DIRECTORY : 0);
+    *__size = 0;
+    if(!(f = fopen(__filename, CL("r")))) return NULL;
+    if(__isdev(f)) {
+        errno = EBADF;
+        return NULL;
+    }
+    size = (size_t)f->size;
+    pages = EFI_SIZE_TO_PAGES(size);
+    status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData, pages ? pages : 1, &addr);
     if(EFI_ERROR(status)) {
-err:    __stdio_seterrno(status);
-        free(ret); return NULL;
+        fclose(f);
+        errno = ENOMEM;
+        return NULL;
     }
-    if(__modes[0] == CL('*')) return ret;
-    status = ret->GetInfo(ret, &infGuid, &fsiz, &info);
-    if(EFI_ERROR(status)) goto err;
-    if(__modes[1] == CL('d') && !(info.Attribute & EFI_FILE_DIRECTORY)) {
-        ret->Close(ret); free(ret); errno = ENOTDIR; return NULL;
+    for(pos = 0; pos < size; pos += n) {
+        n = size - pos > __MAP_CHUNK ? __MAP_CHUNK : size - pos;
+        status = __IOCALL(f->iostat, IOSTAT_READ, &n, f->fh->Read(f->fh, &n, (uint8_t*)addr + pos));
+        if(EFI_ERROR(status) || !n) break;
     }
-    if(__modes[1] != CL('d') && (info.Attribute & EFI_FILE_DIRECTORY)) {
-        ret->Close(ret); free(ret); errno = EISDIR; return NULL;
+    fclose(f);
+    /* a short read means the file shrank, but unmap_file must get the size the pages were allocated for */
+    if(EFI_ERROR(status) || pos < size) {
+        if(EFI_ERROR(status)) __stdio_seterrno(status);
+        else errno = EIO;
+        BS->FreePages(addr, pages ? pages : 1);
+        return NULL;
     }
-    if(__modes[0] == CL('a')) fseek(ret, 0, SEEK_END);
-    if(__modes[0] == CL('w')) {
-        /* manually truncate file size
-         * See https://github.com/tianocore/edk2/blob/master/MdePkg/Library/UefiFileHandleLib/UefiFileHandleLib.c
-         * function FileHandleSetSize */
-        info.FileSize = 0;
-        ret->SetInfo(ret, &infGuid, fsiz, &info);
+    *__size = size;
+    return (void*)addr;
+}
+
+/* mount an archive, loaded with map_file, as a read-only directory tree under path */
+int mount_archive (const char_t *__archive, const char_t *__path)
+{
+    __arcvol_t *a;
+    void *buf;
+    size_t size;
+    uintn_t len;
+    if(!__archive || !__path || __path[0] != CL('/')) {
+        errno = EINVAL;
+        return -1;
+    }
+    for(len = strlen(__path); len > 1 && __path[len - 1] == CL('/'); len--);
+    if(len < 2 || len >= FILENAME_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for(a = __arcvols; a; a = a->next)
+        if(a->len == len && !memcmp(a->path, __path, len * sizeof(char_t))) {
+            errno = EBUSY;
+            return -1;
+        }
+    if(!(buf = map_file(__archive, &size)))
+        return -1;
+    if(!(a = (__arcvol_t*)malloc(sizeof(__arcvol_t)))) {
+        unmap_file(buf, size);
+        errno = ENOMEM;
+        return -1;
     }
-    return ret;
+    memset(a, 0, sizeof(__arcvol_t));
+    if(!(a->vol.root = __archive_open(buf, size))) {
+        unmap_file(buf, size);
+        free(a);
+        return -1;
+    }
+    memcpy(a->path, __path, len * sizeof(char_t));
+    a->len = len;
+    a->next = __arcvols;
+    __arcvols = a;
+    return 0;
 }
 
-size_t fread (void *__ptr, size_t __size, size_t __n, FILE *__stream)
+/* the files still open keep the archive in memory until they are closed */
+int umount_archive (const char_t *__path)
 {
-    uintn_t bs = __size * __n, i, n;
-    efi_status_t status;
-    if(!__ptr || __size < 1 || __n < 1 || !__stream) {
+    __arcvol_t *a, **p;
+    uintn_t len;
+    if(!__path) {
         errno = EINVAL;
-        return 0;
-    }
-    if(__stream == stdin || __stream == stdout || __stream == stderr) {
-        errno = ESPIPE;
-        return 0;
-    }
-    if(__ser && __stream == (FILE*)__ser) {
-        status = __ser->Read(__ser, &bs, __ptr);
-    } else {
-        for(i = 0; i < __blk_ndevs; i++)
-            if(__stream == (FILE*)__blk_devs[i].bio) {
-                n = __blk_devs[i].offset / __blk_devs[i].bio->Media->BlockSize;
-                bs = (bs / __blk_devs[i].bio->Media->BlockSize) * __blk_devs[i].bio->Media->BlockSize;
-                status = __blk_devs[i].bio->ReadBlocks(__blk_devs[i].bio, __blk_devs[i].bio->Media->MediaId, n, bs, __ptr);
-                if(EFI_ERROR(status)) {
-                    __stdio_seterrno(status);
-                    return 0;
-                }
-                __blk_devs[i].offset += bs;
-                return bs / __size;
-            }
-        status = __stream->Read(__stream, &bs, __ptr);
+        return -1;
     }
-    if(EFI_ERROR(status)) {
-        __stdio_seterrno(status);
-        return 0;
+    for(len = strlen(__path); len > 1 && __path[len - 1] == CL('/'); len--);
+    for(p = &__arcvols; (a = *p) && (a->len != len || memcmp(a->path, __path, len * sizeof(char_t))); p = &a->next);
+    if(!a) {
+        errno = EINVAL;
+        return -1;
     }
-    return bs / __size;
+    *p = a->next;
+    __umount(&a->vol);
+    free(a);
+    return 0;
 }
 
-size_t fwrite (const void *__ptr, size_t __size, size_t __n, FILE *__stream)
+int unmap_file (void *__addr, size_t __size)
 {
-    uintn_t bs = __size * __n, n, i;
-    efi_status_t status;
-    if(!__ptr || __size < 1 || __n < 1 || !__stream) {
+    uintn_t pages = EFI_SIZE_TO_PAGES(__size);
+    if(!__addr || ((uintptr_t)__addr & (EFI_PAGE_SIZE - 1))) {
         errno = EINVAL;
-        return 0;
+        return -1;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr) {
-        errno = ESPIPE;
-        return 0;
+    if(EFI_ERROR(BS->FreePages((efi_physical_address_t)(uintptr_t)__addr, pages ? pages : 1))) {
+        errno = EINVAL;
+        return -1;
     }
-    if(__ser && __stream == (FILE*)__ser) {
-        status = __ser->Write(__ser, &bs, (void*)__ptr);
-    } else {
-        for(i = 0; i < __blk_ndevs; i++)
-            if(__stream == (FILE*)__blk_devs[i].bio) {
-                n = __blk_devs[i].offset / __blk_devs[i].bio->Media->BlockSize;
-                bs = (bs / __blk_devs[i].bio->Media->BlockSize) * __blk_devs[i].bio->Media->BlockSize;
-                status = __blk_devs[i].bio->WriteBlocks(__blk_devs[i].bio, __blk_devs[i].bio->Media->MediaId, n, bs, (void*)__ptr);
-                if(EFI_ERROR(status)) {
-                    __stdio_seterrno(status);
-                    return 0;
-                }
-                __blk_devs[i].offset += bs;
-                return bs / __size;
-            }
-        status = __stream->Write(__stream, &bs, (void *)__ptr);
+    return 0;
+}
+
+/* asynchronous I/O. With revision 2 of the file protocol the request is queued with ReadEx / WriteEx and the firmware
+ * signals the token's event when it's done. On older firmware the request is carried out synchronously on submit */
+#define __AIO_READ  1
+#define __AIO_WRITE 2
+
+static void __aio_complete(struct aiocb *__aiocbp)
+{
+    int e = errno;
+    if(__aiocbp->__token.Event) {
+        BS->CloseEvent(__aiocbp->__token.Event);
+        __aiocbp->__token.Event = NULL;
     }
-    if(EFI_ERROR(status)) {
-        __stdio_seterrno(status);
-        return 0;
+    if(EFI_ERROR(__aiocbp->__token.Status)) {
+        __stdio_seterrno(__aiocbp->__token.Status);
+        __aiocbp->__err = errno;
+        errno = e;
+    } else
+        __aiocbp->__err = 0;
+}
+
+/* asynchronous I/O on a block device. The Block IO2 and Disk IO2 tokens start with the same Event and Status fields as
+ * the file token, so aio_error and aio_suspend work the same. Without those protocols, or with a block cache it's synchronous */
+static int __aio_blk(block_file_t *__dev, struct aiocb *__aiocbp, int op)
+{
+    block_file_t *disk = __blk_disk(__dev);
+    efi_block_io_t *bio = disk->bio;
+    efi_block_io_media_t *media = __blk_media(disk);
+    uintn_t bsize = media->BlockSize, unit = __blk_unit(disk);
+    off_t off = __dev->start + __aiocbp->aio_offset, end = __blk_size(__dev);
+    efi_status_t status;
+
+    /* stay within the disk or the partition */
+    __aiocbp->__token.BufferSize = __aiocbp->aio_offset >= end ? 0 :
+        (__aiocbp->aio_nbytes < end - __aiocbp->aio_offset ? __aiocbp->aio_nbytes : end - __aiocbp->aio_offset) / unit * unit;
+    if(off % unit) {
+        errno = __aiocbp->__err = EINVAL;
+        return -1;
     }
-    return bs / __size;
+    /* Block IO2 takes whole blocks only, from a buffer aligned to IoAlign. Anything else goes the synchronous way, where
+     * Disk IO copes with it */
+    if(!disk->cache && (disk->dio2 || (disk->bio2 && !(off % bsize) && !(__aiocbp->__token.BufferSize % bsize) &&
+      (media->IoAlign < 2 || !((uintptr_t)__aiocbp->__token.Buffer % media->IoAlign)))) &&
+      !EFI_ERROR(BS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &__aiocbp->__token.Event))) {
+        if(op == __AIO_WRITE)
+            __ra_drop(disk);
+        if(disk->dio2)
+            status = op == __AIO_READ ?
+                __IOCALL(disk->iostat, IOSTAT_READ, &__aiocbp->__token.BufferSize, disk->dio2->ReadDiskEx(disk->dio2,
+                    bio->Media->MediaId, off, (efi_disk_io2_token_t*)&__aiocbp->__token,
+                    __aiocbp->__token.BufferSize, __aiocbp->__token.Buffer)) :
+                __IOCALL(disk->iostat, IOSTAT_WRITE, &__aiocbp->__token.BufferSize, disk->dio2->WriteDiskEx(disk->dio2,
+                    bio->Media->MediaId, off, (efi_disk_io2_token_t*)&__aiocbp->__token,
+                    __aiocbp->__token.BufferSize, __aiocbp->__token.Buffer));
+        else
+            status = op == __AIO_READ ?
+                __IOCALL(disk->iostat, IOSTAT_READ, &__aiocbp->__token.BufferSize, disk->bio2->ReadBlocksEx(disk->bio2,
+                    bio->Media->MediaId, off / bsize, (efi_block_io2_token_t*)&__aiocbp->__token,
+                    __aiocbp->__token.BufferSize, __aiocbp->__token.Buffer)) :
+                __IOCALL(disk->iostat, IOSTAT_WRITE, &__aiocbp->__token.BufferSize, disk->bio2->WriteBlocksEx(disk->bio2,
+                    bio->Media->MediaId, off / bsize, (efi_block_io2_token_t*)&__aiocbp->__token,
+                    __aiocbp->__token.BufferSize, __aiocbp->__token.Buffer));
+        if(!EFI_ERROR(status))
+            return 0;
+        BS->CloseEvent(__aiocbp->__token.Event);
+        __aiocbp->__token.Event = NULL;
+        if((status & 0xffff) != (EFI_UNSUPPORTED & 0xffff)) {
+            __stdio_seterrno(status);
+            __aiocbp->__err = errno;
+            return -1;
+        }
+    }
+    __aiocbp->__token.Status = __aiocbp->__token.BufferSize ?
+        __blk_rw(disk, op == __AIO_WRITE, off, __aiocbp->__token.BufferSize, __aiocbp->__token.Buffer) :
+        EFI_SUCCESS;
+    __aio_complete(__aiocbp);
+    return 0;
 }
 
-int fseek (FILE *__stream, long int __off, int __whence)
+static int __aio_submit(struct aiocb *__aiocbp, int op)
 {
-    off_t off = 0;
+    block_file_t *dev;
     efi_status_t status;
-    efi_guid_t infoGuid = EFI_FILE_INFO_GUID;
-    efi_file_info_t info;
-    uintn_t fsiz = sizeof(efi_file_info_t), i;
-    if(!__stream || (__whence != SEEK_SET && __whence != SEEK_CUR && __whence != SEEK_END)) {
+    FILE *f;
+    if(!__aiocbp || !__aiocbp->aio_fildes || (!__aiocbp->aio_buf && __aiocbp->aio_nbytes)) {
         errno = EINVAL;
         return -1;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr) {
-        errno = ESPIPE;
-        return -1;
+    f = __aiocbp->aio_fildes;
+    if((dev = __blk_find(f))) {
+        memset(&__aiocbp->__token, 0, sizeof(efi_file_io_token_t));
+        __aiocbp->__token.Buffer = (void*)__aiocbp->aio_buf;
+        __aiocbp->__op = op;
+        __aiocbp->__err = EINPROGRESS;
+        return __aio_blk(dev, __aiocbp, op);
     }
-    if(__ser && __stream == (FILE*)__ser) {
+    if(__isdev(f)) {
         errno = EBADF;
         return -1;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio) {
-            off = (uint64_t)__blk_devs[i].bio->Media->BlockSize * (uint64_t)__blk_devs[i].bio->Media->LastBlock;
-            switch(__whence) {
-                case SEEK_END:
-                    __blk_devs[i].offset = off + __off;
-                    break;
-                case SEEK_CUR:
-                    __blk_devs[i].offset += __off;
-                    break;
-                case SEEK_SET:
-                    __blk_devs[i].offset = __off;
-                    break;
-            }
-            if(__blk_devs[i].offset < 0) __blk_devs[i].offset = 0;
-            if(__blk_devs[i].offset > off) __blk_devs[i].offset = off;
-            __blk_devs[i].offset = (__blk_devs[i].offset / __blk_devs[i].bio->Media->BlockSize) *
-                __blk_devs[i].bio->Media->BlockSize;
+    /* the stream's own buffer must not get in the way */
+    if(__fflush(f)) return -1;
+    memset(&__aiocbp->__token, 0, sizeof(efi_file_io_token_t));
+    __aiocbp->__token.Buffer = (void*)__aiocbp->aio_buf;
+    __aiocbp->__token.BufferSize = __aiocbp->aio_nbytes;
+    __aiocbp->__op = op;
+    __aiocbp->__err = EINPROGRESS;
+    status = __IOCALL(f->iostat, IOSTAT_OTHER, NULL, f->fh->SetPosition(f->fh, __aiocbp->aio_offset));
+    if(EFI_ERROR(status)) goto err;
+    /* like with POSIX aio, the stream's position is unspecified afterwards, but it must match the firmware's */
+    if(f->fh->Revision >= EFI_FILE_PROTOCOL_REVISION2 &&
+      !EFI_ERROR(BS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &__aiocbp->__token.Event))) {
+        status = op == __AIO_READ ?
+            __IOCALL(f->iostat, IOSTAT_READ, &__aiocbp->__token.BufferSize, f->fh->ReadEx(f->fh, &__aiocbp->__token)) :
+            __IOCALL(f->iostat, IOSTAT_WRITE, &__aiocbp->__token.BufferSize, f->fh->WriteEx(f->fh, &__aiocbp->__token));
+        if(!EFI_ERROR(status)) {
+            f->off = __aiocbp->aio_offset + __aiocbp->aio_nbytes;
+            if(op == __AIO_WRITE && f->off > f->size) f->size = f->off;
             return 0;
         }
-    switch(__whence) {
-        case SEEK_END:
-            status = __stream->GetInfo(__stream, &infoGuid, &fsiz, &info);
-            if(!EFI_ERROR(status)) {
-                off = info.FileSize + __off;
-                status = __stream->SetPosition(__stream, off);
-            }
-            break;
-        case SEEK_CUR:
-            status = __stream->GetPosition(__stream, &off);
-            if(!EFI_ERROR(status)) {
-                off += __off;
-                status = __stream->SetPosition(__stream, off);
-            }
-            break;
-        default:
-            status = __stream->SetPosition(__stream, __off);
-            break;
+        BS->CloseEvent(__aiocbp->__token.Event);
+        __aiocbp->__token.Event = NULL;
+        if((status & 0xffff) != (EFI_UNSUPPORTED & 0xffff)) goto err;
     }
-    return EFI_ERROR(status) ? -1 : 0;
+    __aiocbp->__token.Status = op == __AIO_READ ?
+        __IOCALL(f->iostat, IOSTAT_READ, &__aiocbp->__token.BufferSize,
+            f->fh->Read(f->fh, &__aiocbp->__token.BufferSize, __aiocbp->__token.Buffer)) :
+        __IOCALL(f->iostat, IOSTAT_WRITE, &__aiocbp->__token.BufferSize,
+            f->fh->Write(f->fh, &__aiocbp->__token.BufferSize, __aiocbp->__token.Buffer));
+    f->off = __aiocbp->aio_offset + __aiocbp->__token.BufferSize;
+    if(op == __AIO_WRITE && f->off > f->size) f->size = f->off;
+    __aio_complete(__aiocbp);
+    return 0;
+err:
+    __stdio_seterrno(status);
+    __aiocbp->__err = errno;
+    return -1;
 }
 
-long int ftell (FILE *__stream)
+int aio_read (struct aiocb *__aiocbp)
 {
-    uint64_t off = 0;
-    uintn_t i;
-    efi_status_t status;
-    if(!__stream) {
+    return __aio_submit(__aiocbp, __AIO_READ);
+}
+
+int aio_write (struct aiocb *__aiocbp)
+{
+    return __aio_submit(__aiocbp, __AIO_WRITE);
+}
+
+int aio_error (const struct aiocb *__aiocbp)
+{
+    struct aiocb *cb = (struct aiocb*)__aiocbp;
+    if(!cb || !cb->__op) {
         errno = EINVAL;
         return -1;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr) {
-        errno = ESPIPE;
+    if(cb->__err == EINPROGRESS && cb->__token.Event && BS->CheckEvent(cb->__token.Event) == EFI_SUCCESS)
+        __aio_complete(cb);
+    return cb->__err;
+}
+
+ssize_t aio_return (struct aiocb *__aiocbp)
+{
+    if(!__aiocbp || !__aiocbp->__op || __aiocbp->__err == EINPROGRESS) {
+        errno = EINVAL;
         return -1;
     }
-    if(__ser && __stream == (FILE*)__ser) {
-        errno = EBADF;
+    __aiocbp->__op = 0;
+    if(__aiocbp->__err) {
+        errno = __aiocbp->__err;
         return -1;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio) {
-            return (long int)__blk_devs[i].offset;
+    return (ssize_t)__aiocbp->__token.BufferSize;
+}
+
+int aio_suspend (const struct aiocb *const __list[], int __nent, const struct timespec *__timeout)
+{
+    efi_event_t *evs, timer = NULL;
+    struct aiocb **cbs;
+    uintn_t i, n, idx;
+    int ret = -1;
+    if(!__list || __nent < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* WaitForEvent clears the signal, so we must know which request it belongs to */
+    evs = (efi_event_t*)malloc((__nent + 1) * (sizeof(efi_event_t) + sizeof(struct aiocb*)));
+    if(!evs) return -1;
+    cbs = (struct aiocb**)(evs + __nent + 1);
+    for(i = n = 0; i < (uintn_t)__nent; i++)
+        if(__list[i] && __list[i]->__op) {
+            if(aio_error(__list[i]) != EINPROGRESS) { ret = 0; goto end; }
+            cbs[n] = (struct aiocb*)__list[i];
+            evs[n++] = __list[i]->__token.Event;
+        }
+    if(!n) { errno = EINVAL; goto end; }
+    if(__timeout) {
+        if((!__timeout->tv_sec && !__timeout->tv_nsec) || EFI_ERROR(BS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &timer)) ||
+          EFI_ERROR(BS->SetTimer(timer, TimerRelative, __timeout->tv_sec * 10000000 + (uint64_t)__timeout->tv_nsec / 100))) {
+            errno = EAGAIN; goto end;
         }
-    status = __stream->GetPosition(__stream, &off);
-    return EFI_ERROR(status) ? -1 : (long int)off;
+        evs[n++] = timer;
+    }
+    if(EFI_ERROR(BS->WaitForEvent(n, evs, &idx))) { errno = EIO; goto end; }
+    if(timer && idx == n - 1) { errno = EAGAIN; goto end; }
+    __aio_complete(cbs[idx]);
+    ret = 0;
+end:
+    if(timer) BS->CloseEvent(timer);
+    free(evs);
+    return ret;
 }
 
-int feof (FILE *__stream)
+/* cycle counter ticks per millisecond, measured on first use. 0 if the counter can't be used */
+static uint64_t __cycles_ms = (uint64_t)-1;
+
+/* a clock in microseconds, for throughput. The cycle counter is calibrated once against a 10 ms Stall, GetTime is only
+ * a fallback as most firmware has just seconds resolution there and it's slow */
+static uint64_t __copy_usec(void)
 {
-    uint64_t off = 0;
-    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
-    efi_file_info_t info;
-    uintn_t fsiz = (uintn_t)sizeof(efi_file_info_t), i;
-    efi_status_t status;
-    if(!__stream) {
+    efi_time_t t;
+    uint64_t c;
+    if(__cycles_ms == (uint64_t)-1) {
+        c = __cycles();
+        __cycles_ms = c && !EFI_ERROR(BS->Stall(10000)) ? (__cycles() - c) / 10 : 0;
+    }
+    if(__cycles_ms) {
+        c = __cycles();
+        return c / __cycles_ms * 1000 + c % __cycles_ms * 1000 / __cycles_ms;
+    }
+    if(EFI_ERROR(RT->GetTime(&t, NULL))) return 0;
+    return (uint64_t)__mktime_efi(&t) * 1000000 + t.Nanosecond / 1000;
+}
+
+/* copy a file through two page aligned chunks, kept for later copies. The next chunk is read asynchronously while the
+ * previous one is being written, when the firmware supports that */
+int copy_file (const char_t *__src, const char_t *__dst, copy_progress_t __progress)
+{
+    efi_physical_address_t addr = 0;
+    FILE *in = NULL, *out = NULL;
+    struct aiocb cb[2];
+    const struct aiocb *l[1];
+    copy_stat_t st;
+    uint64_t start;
+    ssize_t n;
+    int i = 0, ret = -1, e;
+
+    if(!__src || !__dst) {
         errno = EINVAL;
-        return 0;
+        return -1;
     }
-    if(__stream == stdin || __stream == stdout || __stream == stderr) {
-        errno = ESPIPE;
-        return 0;
+    if(!__copy_buf) {
+        if(EFI_ERROR(BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(2 * __COPY_CHUNK), &addr))) {
+            errno = ENOMEM;
+            return -1;
+        }
+        __copy_buf = (uint8_t*)addr;
     }
-    if(__ser && __stream == (FILE*)__ser) {
+    memset(cb, 0, sizeof(cb));
+    if(!(in = fopen(__src, CL("r"))) || !(out = fopen(__dst, CL("w")))) goto end;
+    if(__isdev(in) || __isdev(out)) {
         errno = EBADF;
-        return 0;
+        goto end;
     }
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio) {
-            errno = EBADF;
-            return __blk_devs[i].offset == (off_t)__blk_devs[i].bio->Media->BlockSize * (off_t)__blk_devs[i].bio->Media->LastBlock;
+    memset(&st, 0, sizeof(copy_stat_t));
+    st.total = in->size;
+    /* allocate the clusters at once, copy works without it too */
+    if(st.total) posix_fallocate(out, 0, st.total);
+    start = __copy_usec();
+    cb[0].aio_fildes = cb[1].aio_fildes = in;
+    cb[0].aio_buf = __copy_buf;
+    cb[1].aio_buf = __copy_buf + __COPY_CHUNK;
+    cb[0].aio_nbytes = cb[1].aio_nbytes = __COPY_CHUNK;
+    if(aio_read(&cb[0])) goto end;
+    while(1) {
+        l[0] = &cb[i];
+        while(aio_error(&cb[i]) == EINPROGRESS)
+            aio_suspend(l, 1, NULL);
+        if((n = aio_return(&cb[i])) < 0) goto end;
+        if(n == __COPY_CHUNK) {
+            cb[i ^ 1].aio_offset = cb[i].aio_offset + n;
+            if(aio_read(&cb[i ^ 1])) goto end;
         }
-    status = __stream->GetPosition(__stream, &off);
-    if(EFI_ERROR(status)) {
-err:    __stdio_seterrno(status);
-        return 1;
+        if(n && fwrite((void*)cb[i].aio_buf, 1, n, out) != (size_t)n) goto end;
+        st.done += n;
+        st.usec = __copy_usec() - start;
+        st.bps = st.usec ? st.done * 1000000 / st.usec : 0;
+        if(__progress && n) (*__progress)(&st);
+        if(n < __COPY_CHUNK) break;
+        i ^= 1;
     }
-    status = __stream->GetInfo(__stream, &infGuid, &fsiz, &info);
-    if(EFI_ERROR(status)) goto err;
-    __stream->SetPosition(__stream, off);
-    return info.FileSize == off;
+    /* the source was shorter than it said */
+    if(st.done != st.total && ftruncate(out, st.done)) goto end;
+    ret = 0;
+end:
+    e = errno;
+    /* don't close the file under a pending read */
+    for(i = 0; i < 2; i++)
+        if(cb[i].__op && aio_error(&cb[i]) == EINPROGRESS) {
+            l[0] = &cb[i];
+            while(aio_error(&cb[i]) == EINPROGRESS)
+                aio_suspend(l, 1, NULL);
+        }
+    if(out && !fclose(out) && !ret) { ret = -1; e = errno; }
+    if(in) fclose(in);
+    errno = e;
+    return ret;
 }
 
-int vsnprintf(char_t *dst, size_t maxlen, const char_t *fmt, __builtin_va_list args)
+/* floating point formatting. The digits are generated exactly with a small bignum and rounded half to even. The non-standard
+ * %r prints the shortest digits that read back to the same value instead, those come from Grisu2 (see Florian Loitsch:
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers"), which sometimes gives one digit too many */
+#define DTOA_MAXPREC 64
+#define DTOA_BUFSIZ  400
+typedef struct { uint64_t f; int e; } __diyfp_t;
+
+static __diyfp_t __diyfp_mul(__diyfp_t x, __diyfp_t y)
+{
+    uint64_t a = x.f >> 32, b = x.f & 0xffffffff, c = y.f >> 32, d = y.f & 0xffffffff;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d, t;
+    t = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff) + (1U << 31);
+    x.f = ac + (ad >> 32) + (bc >> 32) + (t >> 32);
+    x.e += y.e + 64;
+    return x;
+}
+
+/* shortest digits of a positive, finite, non-zero v. Returns the number of digits, value = digits * 10^K */
+static int __dtoa_shortest(double v, char *buf, int *K)
+{
+    static const uint32_t p10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+    /* normalized 10^k for k = -348, -340, ..., 340 */
+    static const uint64_t pf[87] = {
+        0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+        0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+        0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+        0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+        0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+        0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+        0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+        0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+        0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+        0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+        0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+        0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+        0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+        0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+        0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+        0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+        0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+        0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+        0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+        0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+        0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+        0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+        0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+        0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+        0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+        0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+        0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+        0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+        0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+    };
+    static const int16_t pe[87] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+        -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+        -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+        -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+        56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+        694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+        1013, 1039, 1066
+    };
+    union { double d; uint64_t i; } u = { v };
+    __diyfp_t w, wp, wm, c;
+    uint64_t delta, p2, rest, tk, wpw, one;
+    uint32_t p1, d;
+    double dk;
+    int k, sh, kappa, len = 0;
+
+    w.f = u.i & ((1ULL << 52) - 1);
+    w.e = (u.i >> 52) & 0x7ff;
+    if(w.e) { w.f |= 1ULL << 52; w.e -= 1075; } else w.e = -1074;
+    /* boundaries, halfway to the neighbouring doubles */
+    wp.f = (w.f << 1) + 1; wp.e = w.e - 1;
+    while(!(wp.f & (1ULL << 53))) { wp.f <<= 1; wp.e--; }
+    wp.f <<= 10; wp.e -= 10;
+    if(w.f == 1ULL << 52) { wm.f = (w.f << 2) - 1; wm.e = w.e - 2; }
+    else { wm.f = (w.f << 1) - 1; wm.e = w.e - 1; }
+    wm.f <<= wm.e - wp.e; wm.e = wp.e;
+    while(!(w.f & (1ULL << 63))) { w.f <<= 1; w.e--; }
+    /* scale by a cached power of ten so that the binary exponent is in [-59, -32] */
+    dk = (-61 - wp.e) * 0.30102999566398114 + 347;
+    k = (int)dk;
+    if(dk - k > 0.0) k++;
+    k = (k >> 3) + 1;
+    *K = 348 - k * 8;
+    c.f = pf[k]; c.e = pe[k];
+    w = __diyfp_mul(w, c);
+    wp = __diyfp_mul(wp, c); wp.f--;
+    wm = __diyfp_mul(wm, c); wm.f++;
+    delta = wp.f - wm.f;
+    wpw = wp.f - w.f;
+    /* generate digits of the upper boundary until they are within the safe interval */
+    sh = -wp.e; one = 1ULL << sh;
+    p1 = (uint32_t)(wp.f >> sh);
+    p2 = wp.f & (one - 1);
+    for(kappa = 1; kappa < 10 && p1 >= p10[kappa]; kappa++);
+    while(kappa > 0) {
+        d = p1 / p10[kappa - 1];
+        p1 %= p10[kappa - 1];
+        if(d || len) buf[len++] = '0' + d;
+        kappa--;
+        rest = ((uint64_t)p1 << sh) + p2;
+        if(rest <= delta) { tk = (uint64_t)p10[kappa] << sh; goto round; }
+    }
+    while(1) {
+        p2 *= 10;
+        delta *= 10;
+        d = (uint32_t)(p2 >> sh);
+        if(d || len) buf[len++] = '0' + d;
+        p2 &= one - 1;
+        kappa--;
+        if(p2 < delta) { rest = p2; tk = one; wpw *= -kappa < 9 ? p10[-kappa] : 0; break; }
+    }
+round:
+    *K += kappa;
+    /* move the last digit towards the exact value */
+    while(rest < wpw && delta - rest >= tk && (rest + tk < wpw || wpw - rest > rest + tk - wpw)) {
+        buf[len - 1]--;
+        rest += tk;
+    }
+    while(len > 1 && buf[len - 1] == '0') { len--; (*K)++; }
+    return len;
+}
+
+/* exact digits of a positive, finite v. The first digit in buf is non-zero, X is its decimal exponent. Generation stops
+ * past the digit we have to round at (prec digits after the first digit or after the decimal point if fixed), the
+ * rest is reduced to the sticky flag. Returns the number of digits, 0 if the value is too small to show up */
+static int __dtoa_exact(double v, int fixed, int prec, char *buf, int *X, int *sticky)
+{
+    union { double d; uint64_t i; } u = { v };
+    uint32_t n[36], ch[36], r, d, q;
+    uint64_t m, t;
+    int e, s, i, nl, nc, len = 0, pos;
+
+    m = u.i & ((1ULL << 52) - 1);
+    e = (u.i >> 52) & 0x7ff;
+    if(e) { m |= 1ULL << 52; e -= 1075; } else e = -1074;
+    s = e < 0 ? -e : 0;
+    *X = 0; *sticky = 0;
+    for(i = 0; i < 36; i++) n[i] = 0;
+    /* integer part, converted to 9 digit chunks by dividing with 10^9 */
+    if(e >= 0) {
+        i = e & 31;
+        t = m << i;
+        n[e >> 5] = (uint32_t)t; n[(e >> 5) + 1] = (uint32_t)(t >> 32);
+        if(i) n[(e >> 5) + 2] = (uint32_t)(m >> (64 - i));
+    } else if(s < 64) {
+        t = m >> s;
+        n[0] = (uint32_t)t; n[1] = (uint32_t)(t >> 32);
+    }
+    for(nl = 36; nl && !n[nl - 1]; nl--);
+    for(nc = 0; nl; ) {
+        for(r = 0, i = nl - 1; i >= 0; i--) {
+            t = ((uint64_t)r << 32) | n[i];
+            n[i] = (uint32_t)(t / 1000000000);
+            r = (uint32_t)(t % 1000000000);
+        }
+        ch[nc++] = r;
+        while(nl && !n[nl - 1]) nl--;
+    }
+    while(nc--)
+        for(q = 100000000; q; q /= 10) {
+            d = ch[nc] / q % 10;
+            if(d || len) buf[len++] = '0' + d;
+        }
+    if(len) *X = len - 1;
+    if(e >= 0) return len;
+    /* fraction part, multiply by 10^9 and take the 9 digits above the binary point each time */
+    t = s < 64 ? m & ((1ULL << s) - 1) : m;
+    n[0] = (uint32_t)t; n[1] = (uint32_t)(t >> 32);
+    nl = (s >> 5) + 2;
+    pos = -1;
+    while(1) {
+        if(len ? len > (fixed ? *X + 1 + prec : prec + 1) : fixed && pos < -(prec + 1)) break;
+        for(i = 0; i < nl && !n[i]; i++);
+        if(i == nl) return len;
+        for(r = 0, i = 0; i < nl; i++) {
+            t = (uint64_t)n[i] * 1000000000 + r;
+            n[i] = (uint32_t)t;
+            r = (uint32_t)(t >> 32);
+        }
+        t = n[s >> 5] | ((uint64_t)n[(s >> 5) + 1] << 32);
+        r = (uint32_t)(t >> (s & 31));
+        n[s >> 5] &= (1U << (s & 31)) - 1;
+        n[(s >> 5) + 1] = 0;
+        for(q = 100000000; q; q /= 10, pos--) {
+            d = r / q % 10;
+            if(d || len) {
+                if(!len) *X = pos;
+                buf[len++] = '0' + d;
+            }
+        }
+    }
+    for(i = 0; i < nl && !n[i]; i++);
+    *sticky = i < nl;
+    return len;
+}
+
+/* round the digits to keep many, half to even. Returns the new number of digits */
+static int __dtoa_round(char *buf, int len, int keep, int fixed, int *X, int sticky)
+{
+    int i;
+    if(keep < 0) return 0;
+    if(len > keep) {
+        for(i = keep + 1; i < len && !sticky; i++)
+            if(buf[i] != '0') sticky = 1;
+        if(buf[keep] > '5' || (buf[keep] == '5' && (sticky || (keep && (buf[keep - 1] & 1))))) {
+            for(i = keep - 1; i >= 0 && buf[i] == '9'; i--) buf[i] = '0';
+            if(i >= 0) buf[i]++;
+            else {
+                /* carried out from the first digit, 99.9 -> 100.0 */
+                buf[0] = '1';
+                for(i = 1; i <= keep; i++) buf[i] = '0';
+                (*X)++;
+                if(fixed) keep++;
+            }
+        }
+    } else
+        for(i = len; i < keep; i++) buf[i] = '0';
+    return keep;
+}
+
+/* Grisu2 can't always tell if fewer digits would do. Returns 1 and the digits if v rounded to n digits reads back the same */
+static int __dtoa_fewer(double v, int n, char *buf, int *X)
+{
+    char tmp[DTOA_BUFSIZ];
+    char_t str[32], *o = str;
+    int len, x, sticky, i;
+    len = __dtoa_exact(v, 0, n - 1, tmp, &x, &sticky);
+    len = __dtoa_round(tmp, len, n, 0, &x, sticky);
+    *o++ = tmp[0];
+    *o++ = CL('.');
+    for(i = 1; i < len; i++) *o++ = tmp[i];
+    *o++ = CL('e');
+    if(x < 0) { *o++ = CL('-'); i = -x; } else i = x;
+    if(i >= 100) *o++ = CL('0') + i / 100;
+    *o++ = CL('0') + i / 10 % 10;
+    *o++ = CL('0') + i % 10;
+    *o = 0;
+    if(strtod(str, NULL) != v) return 0;
+    memcpy(buf, tmp, len);
+    *X = x;
+    return 1;
+}
+
+/* format a double into out, fc is one of f, F, e, E, g, G, and r for the shortest round-trip digits */
+static void __dtoa(double v, char_t fc, int prec, int width, char_t pad, char_t *out)
+{
+    union { double d; uint64_t i; } u = { v };
+    char buf[DTOA_BUFSIZ], *s;
+    char_t *o = out, *z;
+    int len = 0, X = 0, K, sticky, exp, i, upper = fc == CL('F') || fc == CL('E') || fc == CL('G');
+    if(fc == CL('r')) { fc = CL('g'); prec = -1; }
+
+    if(prec > DTOA_MAXPREC) prec = DTOA_MAXPREC;
+    if(width > DTOA_BUFSIZ - 1) width = DTOA_BUFSIZ - 1;
+    if(u.i >> 63) *o++ = CL('-');
+    u.i &= -1ULL >> 1;
+    if(u.i >= 0x7ff0000000000000ULL) {
+        for(s = u.i > 0x7ff0000000000000ULL ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf"); *s; s++) *o++ = *s;
+        pad = CL(' ');
+        goto done;
+    }
+    if(fc == CL('F')) fc = CL('f');
+    if(fc == CL('E')) fc = CL('e');
+    if(fc == CL('G')) fc = CL('g');
+    exp = fc == CL('e');
+    if(prec < 0) {
+        /* shortest round-trip representation */
+        if(u.i) {
+            len = __dtoa_shortest(u.d, buf, &K);
+            X = len - 1 + K;
+            while(len > 1 && __dtoa_fewer(u.d, len - 1, buf, &X)) len--;
+        }
+        if(fc == CL('g')) exp = X < -4 || X >= 16;
+        prec = exp ? len - 1 : len - 1 - X;
+        if(prec < 0) prec = 0;
+    } else {
+        if(fc == CL('g')) {
+            /* precision means significant digits here, trailing zeros are removed */
+            if(!prec) prec = 1;
+            if(u.i) {
+                len = __dtoa_exact(u.d, 0, prec - 1, buf, &X, &sticky);
+                len = __dtoa_round(buf, len, prec, 0, &X, sticky);
+            }
+            exp = X < -4 || X >= prec;
+            prec = exp ? prec - 1 : prec - 1 - X;
+            for(i = len; i > 1 && buf[i - 1] == '0'; i--);
+            len = i;
+            if(prec > len - 1 - (exp ? 0 : X)) prec = len - 1 - (exp ? 0 : X);
+            if(prec < 0) prec = 0;
+        } else if(u.i) {
+            len = __dtoa_exact(u.d, !exp, prec, buf, &X, &sticky);
+            len = __dtoa_round(buf, len, exp ? prec + 1 : (len ? X + 1 + prec : 0), !exp, &X, sticky);
+            if(!len) X = 0;
+        }
+    }
+#define DIGIT(i) (i >= 0 && i < len ? buf[i] : '0')
+    if(exp) {
+        *o++ = DIGIT(0);
+        if(prec) *o++ = CL('.');
+        for(i = 1; i <= prec; i++) *o++ = DIGIT(i);
+        *o++ = upper ? CL('E') : CL('e');
+        if(!len) X = 0;
+        if(X < 0) { *o++ = CL('-'); X = -X; } else *o++ = CL('+');
+        if(X >= 100) *o++ = CL('0') + X / 100;
+        *o++ = CL('0') + X / 10 % 10;
+        *o++ = CL('0') + X % 10;
+    } else {
+        if(X < 0) *o++ = CL('0');
+        else for(i = 0; i <= X; i++) *o++ = DIGIT(i);
+        if(prec) *o++ = CL('.');
+        for(i = 1; i <= prec; i++) *o++ = DIGIT(X + i);
+    }
+#undef DIGIT
+done:
+    *o = 0;
+    /* padding to width, zeros go after the sign */
+    i = (int)(o - out);
+    if(width > i) {
+        z = out + (pad == CL('0') && *out == CL('-'));
+        for(K = i; K >= (int)(z - out); K--) out[K + width - i] = out[K];
+        for(K = 0; K < width - i; K++) z[K] = pad;
+    }
+}
+
+static const char __digits2[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/* formatter output is collected in fixed size chunks and passed to a sink, except for the console, where characters
+ * are written directly into the UCS-2 console buffer */
+#define FMT_CHUNK 256
+typedef struct __fmt_s __fmt_t;
+struct __fmt_s {
+    int (*sink)(__fmt_t *f, int len);   /* returns non-zero to stop formatting */
+    void *ctx;
+    __con_t *con;                       /* if set, no sink, output goes to this console buffer */
+    char_t *dst, *end;
+    int n, total, err, need, nl;
+    uint32_t u;                         /* UTF-8 decoder state */
+    char_t last;
+    char_t buf[FMT_CHUNK + 1];
+};
+
+static inline void __fmt_putw(__fmt_t *f, char_t ch)
+{
+    __con_t *c = f->con;
+    wchar_t w;
+#ifndef UEFI_NO_UTF8
+    uint8_t b = (uint8_t)ch;
+    if(b < 0x80) { w = b; f->need = 0; } else
+    if(b < 0xC0) {
+        if(!f->need) return;
+        f->u = (f->u << 6) | (b & 0x3F);
+        if(--f->need) return;
+        w = (wchar_t)f->u;
+    } else {
+        f->need = b >= 0xF0 ? 3 : (b >= 0xE0 ? 2 : 1);
+        f->u = b & (0x3F >> f->need);
+        return;
+    }
+#else
+    w = ch;
+#endif
+    if(c->pos >= c->bufsiz) __con_flush(c);
+    c->buf[c->pos++] = w;
+    if(w == L'\n') f->nl = 1;
+}
+
+static int __fmt_flush(__fmt_t *f, int all)
+{
+    int n = f->n, i, r;
+    char_t c;
+#ifndef UEFI_NO_UTF8
+    /* never split a multibyte sequence, keep its head for the next chunk */
+    if(!all && n > 1) {
+        for(i = n - 1; i > 0 && i > n - 4 && ((uint8_t)f->buf[i] & 0xC0) == 0x80; i--);
+        c = f->buf[i];
+        r = ((uint8_t)c & 0xF0) == 0xF0 ? 4 : (((uint8_t)c & 0xE0) == 0xE0 ? 3 : (((uint8_t)c & 0xC0) == 0xC0 ? 2 : 1));
+        if(i > 0 && i + r > n) n = i;
+    }
+#else
+    (void)all;
+#endif
+    c = f->buf[n]; f->buf[n] = 0;
+    r = f->sink(f, n);
+    f->buf[n] = c;
+    f->total += n;
+    for(i = n; i < f->n; i++) f->buf[i - n] = f->buf[i];
+    f->n -= n;
+    return r;
+}
+
+static int __vformat(__fmt_t *f, const char_t *fmt, __builtin_va_list args)
 {
 #define needsescape(a) (a==CL('\"') || a==CL('\\') || a==CL('\a') || a==CL('\b') || a==CL('\033') || a==CL('\f') || \
     a==CL('\r') || a==CL('\n') || a==CL('\t') || a==CL('\v'))
+#define PUT(a) do { f->last = (char_t)(a); if(f->con) { __fmt_putw(f, f->last); f->total++; } \
+    else if(f->n < FMT_CHUNK || !__fmt_flush(f, 0)) f->buf[f->n++] = f->last; else goto stop; } while(0)
     efi_physical_address_t m;
     uint8_t *mem;
     uint64_t arg;
     int64_t iarg;
-    int len, sign, i, j;
-    char_t *p, *orig=dst, *end = dst + maxlen - 1, tmpstr[24], pad, n;
+    int len, prec, sign, i, j;
+    char_t *p, tmpstr[24], pad, n, fltstr[DTOA_BUFSIZ];
 #ifdef UEFI_NO_UTF8
     char *c;
 #endif
-    if(dst==NULL || fmt==NULL)
+    f->n = f->total = f->err = f->need = f->nl = 0;
+    f->last = 0;
+    if(fmt==NULL)
         return 0;
 
     arg = 0;
-    while(*fmt && dst < end) {
+    while(*fmt) {
         if(*fmt==CL('%')) {
             fmt++;
             if(*fmt==CL('%')) goto put;
@@ -535,15 +3222,21 @@ int vsnprintf(char_t *dst, size_t maxlen, const char_t *fmt, __builtin_va_list a
                 len += *fmt-CL('0');
                 fmt++;
             }
+            prec=-1;
+            if(*fmt==CL('.')) {
+                fmt++;
+                for(prec=0; *fmt>=CL('0') && *fmt<=CL('9'); fmt++)
+                    prec = prec * 10 + *fmt-CL('0');
+            }
             if(*fmt==CL('l')) fmt++;
             if(*fmt==CL('c')) {
                 arg = __builtin_va_arg(args, uint32_t);
 #ifndef UEFI_NO_UTF8
-                if(arg<0x80) { *dst++ = arg; } else
-                if(arg<0x800) { *dst++ = ((arg>>6)&0x1F)|0xC0; *dst++ = (arg&0x3F)|0x80; } else
-                { *dst++ = ((arg>>12)&0x0F)|0xE0; *dst++ = ((arg>>6)&0x3F)|0x80; *dst++ = (arg&0x3F)|0x80; }
+                if(arg<0x80) { PUT(arg); } else
+                if(arg<0x800) { PUT(((arg>>6)&0x1F)|0xC0); PUT((arg&0x3F)|0x80); } else
+                { PUT(((arg>>12)&0x0F)|0xE0); PUT(((arg>>6)&0x3F)|0x80); PUT((arg&0x3F)|0x80); }
 #else
-                *dst++ = (wchar_t)(arg & 0xffff);
+                PUT(arg & 0xffff);
 #endif
                 fmt++;
                 continue;
@@ -557,18 +3250,29 @@ int vsnprintf(char_t *dst, size_t maxlen, const char_t *fmt, __builtin_va_list a
                 } else arg=(uint64_t)iarg;
                 i=23;
                 tmpstr[i]=0;
-                do {
-                    tmpstr[--i]=CL('0')+(arg%10);
-                    arg/=10;
-                } while(arg!=0 && i>0);
-                if(sign) {
+                /* two digits at once from a table, uint64 has 20 digits at most */
+                for(; arg >= 100; arg /= 100) {
+                    j = (int)(arg % 100) * 2;
+                    tmpstr[--i]=__digits2[j + 1];
+                    tmpstr[--i]=__digits2[j];
+                }
+                if(arg >= 10) {
+                    tmpstr[--i]=__digits2[arg * 2 + 1];
+                    tmpstr[--i]=__digits2[arg * 2];
+                } else
+                    tmpstr[--i]=CL('0')+arg;
+                /* zeros go between the sign and the digits */
+                if(sign && pad!=CL('0')) {
                     tmpstr[--i]=CL('-');
                 }
                 if(len>0 && len<23) {
-                    while(i && i>23-len) {
+                    while(i && i>23-len+(sign && pad==CL('0'))) {
                         tmpstr[--i]=pad;
                     }
                 }
+                if(sign && pad==CL('0')) {
+                    tmpstr[--i]=CL('-');
+                }
                 p=&tmpstr[i];
                 goto copystring;
             } else
@@ -595,36 +3299,42 @@ hex:            i=16;
                 p=&tmpstr[i];
                 goto copystring;
             } else
+            if(*fmt==CL('f') || *fmt==CL('F') || *fmt==CL('e') || *fmt==CL('E') || *fmt==CL('g') || *fmt==CL('G') ||
+              *fmt==CL('r')) {
+                __dtoa(__builtin_va_arg(args, double), *fmt, prec < 0 ? 6 : prec, len, pad, fltstr);
+                p=fltstr;
+                goto copystring;
+            } else
             if(*fmt==CL('s') || *fmt==CL('q')) {
                 p = __builtin_va_arg(args, char_t*);
 copystring:     if(p==NULL) {
                     p=CL("(null)");
                 }
-                while(*p && dst + 2 < end) {
+                for(; *p; p++) {
                     if(*fmt==CL('q') && needsescape(*p)) {
-                        *dst++ = CL('\\');
+                        PUT(CL('\\'));
                         switch(*p) {
-                            case CL('\a'): *dst++ = CL('a'); break;
-                            case CL('\b'): *dst++ = CL('b'); break;
-                            case 27:       *dst++ = CL('e'); break; /* gcc 10.2 doesn't like CL('\e') in ansi mode */
-                            case CL('\f'): *dst++ = CL('f'); break;
-                            case CL('\n'): *dst++ = CL('n'); break;
-                            case CL('\r'): *dst++ = CL('r'); break;
-                            case CL('\t'): *dst++ = CL('t'); break;
-                            case CL('\v'): *dst++ = CL('v'); break;
-                            default: *dst++ = *p++; break;
+                            case CL('\a'): PUT(CL('a')); break;
+                            case CL('\b'): PUT(CL('b')); break;
+                            case 27:       PUT(CL('e')); break; /* gcc 10.2 doesn't like CL('\e') in ansi mode */
+                            case CL('\f'): PUT(CL('f')); break;
+                            case CL('\n'): PUT(CL('n')); break;
+                            case CL('\r'): PUT(CL('r')); break;
+                            case CL('\t'): PUT(CL('t')); break;
+                            case CL('\v'): PUT(CL('v')); break;
+                            default: PUT(*p); break;
                         }
                     } else {
-                        if(*p == CL('\n') && (orig == dst || *(dst - 1) != CL('\r'))) *dst++ = CL('\r');
-                        *dst++ = *p++;
+                        if(*p == CL('\n') && f->last != CL('\r')) PUT(CL('\r'));
+                        PUT(*p);
                     }
                 }
             } else
 #ifdef UEFI_NO_UTF8
             if(*fmt==L'S' || *fmt==L'Q') {
                 c = __builtin_va_arg(args, char*);
-                if(c==NULL) goto copystring;
-                while(*p && dst + 2 < end) {
+                if(c==NULL) { p = NULL; goto copystring; }
+                for(; *c; c++) {
                     arg = *c;
                     if((*c & 128) != 0) {
                         if((*c & 32) == 0 ) {
@@ -643,21 +3353,21 @@ copystring:     if(p==NULL) {
                     }
                     if(!arg) break;
                     if(*fmt==L'Q' && needsescape(arg)) {
-                        *dst++ = L'\\';
+                        PUT(L'\\');
                         switch(arg) {
-                            case L'\a': *dst++ = L'a'; break;
-                            case L'\b': *dst++ = L'b'; break;
-                            case 27:    *dst++ = L'e'; break;   /* gcc 10.2 doesn't like L'\e' in ansi mode */
-                            case L'\f': *dst++ = L'f'; break;
-                            case L'\n': *dst++ = L'n'; break;
-                            case L'\r': *dst++ = L'r'; break;
-                            case L'\t': *dst++ = L't'; break;
-                            case L'\v': *dst++ = L'v'; break;
-                            default: *dst++ = arg; break;
+                            case L'\a': PUT(L'a'); break;
+                            case L'\b': PUT(L'b'); break;
+                            case 27:    PUT(L'e'); break;   /* gcc 10.2 doesn't like L'\e' in ansi mode */
+                            case L'\f': PUT(L'f'); break;
+                            case L'\n': PUT(L'n'); break;
+                            case L'\r': PUT(L'r'); break;
+                            case L'\t': PUT(L't'); break;
+                            case L'\v': PUT(L'v'); break;
+                            default: PUT(arg); break;
                         }
                     } else {
-                        if(arg == L'\n') *dst++ = L'\r';
-                        *dst++ = (wchar_t)(arg & 0xffff);
+                        if(arg == L'\n' && f->last != L'\r') PUT(L'\r');
+                        PUT(arg & 0xffff);
                     }
                 }
             } else
@@ -666,41 +3376,100 @@ copystring:     if(p==NULL) {
                 m = __builtin_va_arg(args, efi_physical_address_t);
                 for(j = 0; j < (len < 1 ? 1 : (len > 16 ? 16 : len)); j++) {
                     for(i = 44; i >= 0; i -= 4) {
-                        n = (m >> i) & 15; *dst++ = n + (n>9?0x37:0x30);
-                        if(dst >= end) goto zro;
+                        n = (m >> i) & 15; PUT(n + (n>9?0x37:0x30));
                     }
-                    *dst++ = CL(':'); if(dst >= end) goto zro;
-                    *dst++ = CL(' '); if(dst >= end) goto zro;
+                    PUT(CL(':'));
+                    PUT(CL(' '));
                     mem = (uint8_t*)m;
                     for(i = 0; i < 16; i++) {
-                        n = (mem[i] >> 4) & 15; *dst++ = n + (n>9?0x37:0x30); if(dst >= end) goto zro;
-                        n = mem[i] & 15; *dst++ = n + (n>9?0x37:0x30); if(dst >= end) goto zro;
-                        *dst++ = CL(' ');if(dst >= end) goto zro;
+                        n = (mem[i] >> 4) & 15; PUT(n + (n>9?0x37:0x30));
+                        n = mem[i] & 15; PUT(n + (n>9?0x37:0x30));
+                        PUT(CL(' '));
                     }
-                    *dst++ = CL(' '); if(dst >= end) goto zro;
+                    PUT(CL(' '));
                     for(i = 0; i < 16; i++) {
-                        *dst++ = (mem[i] < 32 || mem[i] >= 127 ? CL('.') : (char_t)mem[i]);
-                        if(dst >= end) goto zro;
+                        PUT(mem[i] < 32 || mem[i] >= 127 ? CL('.') : (char_t)mem[i]);
                     }
-                    *dst++ = CL('\r'); if(dst >= end) goto zro;
-                    *dst++ = CL('\n'); if(dst >= end) goto zro;
+                    PUT(CL('\r'));
+                    PUT(CL('\n'));
                     m += 16;
                 }
             }
         } else {
-put:        if(*fmt == CL('\n') && (orig == dst || *(dst - 1) != CL('\r'))) *dst++ = CL('\r');
-            *dst++ = *fmt;
+put:        if(*fmt == CL('\n') && f->last != CL('\r')) PUT(CL('\r'));
+            PUT(*fmt);
         }
         fmt++;
     }
-zro:*dst=0;
-    return (int)(dst-orig);
+    if(f->n) __fmt_flush(f, 1);
+stop:
+    return f->total;
+#undef PUT
 #undef needsescape
 }
 
+/* memory sink, end is NULL when the buffer is unbounded */
+static int __fmt_mem(__fmt_t *f, int len)
+{
+    if(f->end && len > (int)(f->end - f->dst)) {
+        len = (int)(f->end - f->dst);
+        f->err = 1;
+    }
+    memcpy(f->dst, f->buf, len * sizeof(char_t));
+    f->dst += len;
+    return f->err;
+}
+
+static int __fmt_console(__con_t *c, const char_t *fmt, __builtin_va_list args)
+{
+    __fmt_t f;
+    int ret;
+    f.con = c;
+    ret = __vformat(&f, fmt, args);
+    if(c->mode == _IONBF || (c->mode == _IOLBF && f.nl)) __con_flush(c);
+    return ret;
+}
+
+static int __fmt_ser(__fmt_t *f, int len)
+{
+    efi_status_t status;
+    uintn_t bs;
+#ifndef UEFI_NO_UTF8
+    bs = (uintn_t)len;
+    status = __IOCALL(__ser_iostat, IOSTAT_WRITE, &bs, __ser->Write(__ser, &bs, (void*)f->buf));
+#else
+    char tmp[FMT_CHUNK * 4];
+    (void)len;
+    bs = wcstombs(tmp, f->buf, sizeof(tmp));
+    status = __IOCALL(__ser_iostat, IOSTAT_WRITE, &bs, __ser->Write(__ser, &bs, (void*)tmp));
+#endif
+    if(EFI_ERROR(status)) { __stdio_seterrno(status); f->err = 1; }
+    return f->err;
+}
+
+static int __fmt_file(__fmt_t *f, int len)
+{
+    if(fwrite(f->buf, sizeof(char_t), len, (FILE*)f->ctx) != (size_t)len) f->err = 1;
+    return f->err;
+}
+
+int vsnprintf(char_t *dst, size_t maxlen, const char_t *fmt, __builtin_va_list args)
+{
+    __fmt_t f;
+    if(dst==NULL || fmt==NULL || !maxlen)
+        return 0;
+    f.sink = __fmt_mem;
+    f.con = NULL;
+    f.dst = dst;
+    f.end = maxlen == (size_t)-1 ? NULL : dst + maxlen - 1;
+    __vformat(&f, fmt, args);
+    *f.dst = 0;
+    return (int)(f.dst - dst);
+}
+
 int vsprintf(char_t *dst, const char_t *fmt, __builtin_va_list args)
 {
-    return vsnprintf(dst, BUFSIZ, fmt, args);
+    return vsnprintf(dst, (size_t)-1, fmt, args);
 }
 
 int sprintf(char_t *dst, const char_t* fmt, ...)
@@ -708,7 +3477,7 @@ int sprintf(char_t *dst, const char_t* fmt, ...)
     int ret;
     __builtin_va_list args;
     __builtin_va_start(args, fmt);
-    ret = vsnprintf(dst, BUFSIZ, fmt, args);
+    ret = vsnprintf(dst, (size_t)-1, fmt, args);
     __builtin_va_end(args);
     return ret;
 }
@@ -725,17 +3494,7 @@ int snprintf(char_t *dst, size_t maxlen, const char_t* fmt, ...)
 
 int vprintf(const char_t* fmt, __builtin_va_list args)
 {
-    int ret;
-    wchar_t dst[BUFSIZ];
-#ifndef UEFI_NO_UTF8
-    char_t tmp[BUFSIZ];
-    ret = vsnprintf(tmp, BUFSIZ, fmt, args);
-    mbstowcs(dst, tmp, BUFSIZ - 1);
-#else
-    ret = vsnprintf(dst, BUFSIZ, fmt, args);
-#endif
-    ST->ConOut->OutputString(ST->ConOut, (wchar_t *)&dst);
-    return ret;
+    return __fmt_console(&__con[0], fmt, args);
 }
 
 int printf(const char_t* fmt, ...)
@@ -750,37 +3509,23 @@ int printf(const char_t* fmt, ...)
 
 int vfprintf (FILE *__stream, const char_t *__format, __builtin_va_list args)
 {
-    wchar_t dst[BUFSIZ];
-    char_t tmp[BUFSIZ];
-    uintn_t ret, i;
-#ifndef UEFI_NO_UTF8
-    ret = (uintn_t)vsnprintf(tmp, BUFSIZ, __format, args);
-    ret = mbstowcs(dst, tmp, BUFSIZ - 1);
-#else
-    ret = vsnprintf(dst, BUFSIZ, __format, args);
-#endif
-    if(ret < 1 || !__stream || __stream == stdin) return 0;
-    for(i = 0; i < __blk_ndevs; i++)
-        if(__stream == (FILE*)__blk_devs[i].bio) {
-            errno = EBADF;
-            return -1;
-        }
-    if(__stream == stdout)
-        ST->ConOut->OutputString(ST->ConOut, (wchar_t*)&dst);
-    else if(__stream == stderr)
-        ST->StdErr->OutputString(ST->StdErr, (wchar_t*)&dst);
-    else if(__ser && __stream == (FILE*)__ser) {
-#ifdef UEFI_NO_UTF8
-        wcstombs((char*)&tmp, dst, BUFSIZ - 1);
-#endif
-        __ser->Write(__ser, &ret, (void*)&tmp);
-    } else
-#ifndef UEFI_NO_UTF8
-        __stream->Write(__stream, &ret, (void*)&tmp);
-#else
-        __stream->Write(__stream, &ret, (void*)&dst);
-#endif
-    return (int)ret;
+    __fmt_t f;
+    int ret;
+    if(!__stream || __stream == stdin) return 0;
+    if(__blk_find(__stream)) {
+        errno = EBADF;
+        return -1;
+    }
+    if(__stream == stdout || __stream == stderr)
+        return __fmt_console(&__con[__stream == stderr], __format, args);
+    f.con = NULL;
+    if(__ser && __stream == (FILE*)__ser) {
+        f.sink = __fmt_ser; f.ctx = __ser;
+    } else {
+        f.sink = __fmt_file; f.ctx = __stream;
+    }
+    ret = __vformat(&f, __format, args);
+    return f.err ? -1 : ret;
 }
 
 int fprintf (FILE *__stream, const char_t *__format, ...)
@@ -796,13 +3541,17 @@ int fprintf (FILE *__stream, const char_t *__format, ...)
 int getchar_ifany (void)
 {
     efi_input_key_t key = { 0 };
-    efi_status_t status = ST->ConIn->ReadKeyStroke(ST->ConIn, &key);
+    efi_status_t status;
+    /* make sure the prompt is visible before we read */
+    __con_flush(&__con[0]);
+    status = ST->ConIn->ReadKeyStroke(ST->ConIn, &key);
     return EFI_ERROR(status) ? 0 : key.UnicodeChar;
 }
 
 int getchar (void)
 {
     uintn_t idx;
+    __con_flush(&__con[0]);
     BS->WaitForEvent(1, &ST->ConIn->WaitForKey, &idx);
     return getchar_ifany();
 }
@@ -810,8 +3559,9 @@ int getchar (void)
 int putchar (int __c)
 {
     wchar_t tmp[2];
-    tmp[0] = (wchar_t)__c;
-    tmp[1] = 0;
-    ST->ConOut->OutputString(ST->ConOut, (__c == L'\n' ? (wchar_t*)L"\r\n" : (wchar_t*)&tmp));
-    return (int)tmp[0];
+    tmp[0] = L'\r';
+    tmp[1] = (wchar_t)__c;
+    __con_write(&__con[0], __c == L'\n' ? tmp : tmp + 1, __c == L'\n' ? 2 : 1);
+    if(__con[0].mode == _IONBF) __con_flush(&__con[0]);
+    return (int)tmp[1];
 }
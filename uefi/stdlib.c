@@ -31,7 +31,6 @@
 #include <uefi.h>
 
 int errno = 0;
-static uint64_t __srand_seed = 6364136223846793005ULL;
 extern void __stdio_cleanup(void);
 #ifndef UEFI_NO_TRACK_ALLOC
 static uintptr_t *__stdlib_allocs = NULL;
@@ -45,36 +44,315 @@ int atoi(const char_t *s)
 
 int64_t atol(const char_t *s)
 {
-    int64_t sign = 1;
-    if(!s || !*s) return 0;
-    if(*s == CL('-')) { sign = -1; s++; }
-    if(s[0] == CL('0')) {
-        if(s[1] == CL('x'))
-            return strtol(s + 2, NULL, 16) * sign;
-        if(s[1] >= CL('0') && s[1] <= CL('7'))
-            return strtol(s, NULL, 8) * sign;
+    return strtol(s, NULL, 0);
+}
+
+/* digit value in bases up to 36, or 36 if it's not a digit at all */
+static int __digit(char_t c)
+{
+    if(c >= CL('0') && c <= CL('9')) return c - CL('0');
+    c |= 0x20;
+    if(c >= CL('a') && c <= CL('z')) return c - CL('a') + 10;
+    return 36;
+}
+
+#ifndef UEFI_NO_UTF8
+/* SWAR, check if the next 8 characters are all digits and convert them at once. Only if the load doesn't cross a page
+ * boundary, because that could fault after the end of the string */
+static int __swar_dec8(const char *s, uint64_t *r)
+{
+    uint64_t v;
+    if(((uintptr_t)s & 4095) > 4096 - 8) return 0;
+    __builtin_memcpy(&v, s, 8);
+    if(((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL)
+        return 0;
+    v = (v & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+    v = (v & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+    *r = (v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32;
+    return 1;
+}
+
+static int __swar_hex8(const char *s, uint64_t *r)
+{
+    uint64_t v, l, d, a;
+    if(((uintptr_t)s & 4095) > 4096 - 8) return 0;
+    __builtin_memcpy(&v, s, 8);
+    if(v & 0x8080808080808080ULL) return 0;
+    /* high bit of each byte set if it's in '0'..'9', or in 'a'..'f' case insensitive */
+    l = v | 0x2020202020202020ULL;
+    d = ((v | 0x8080808080808080ULL) - 0x3030303030303030ULL) & ~(v + 0x4646464646464646ULL) & 0x8080808080808080ULL;
+    a = ((l | 0x8080808080808080ULL) - 0x6161616161616161ULL) & ~(l + 0x1919191919191919ULL) & 0x8080808080808080ULL;
+    if((d | a) != 0x8080808080808080ULL) return 0;
+    v = __builtin_bswap64((v & 0x0F0F0F0F0F0F0F0FULL) + (a >> 7) * 9);
+    v = (v | (v >> 4)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v >> 8)) & 0x0000FFFF0000FFFFULL;
+    *r = (v | (v >> 16)) & 0xFFFFFFFFULL;
+    return 1;
+}
+#endif
+
+/* common part of the strto* functions, returns the magnitude */
+static uint64_t __strtou(const char_t *s, char_t **__endptr, int __base, int *neg, int *ovf)
+{
+    const char_t *p = s, *q;
+    uint64_t v = 0;
+#ifndef UEFI_NO_UTF8
+    uint64_t t;
+#endif
+    int d;
+
+    *neg = *ovf = 0;
+    if(__endptr) *__endptr = (char_t*)s;
+    if(!s || __base < 0 || __base == 1 || __base > 36) { errno = EINVAL; return 0; }
+    while(*p == CL(' ') || (*p >= CL('\t') && *p <= CL('\r'))) p++;
+    if(*p == CL('-') || *p == CL('+')) *neg = *p++ == CL('-');
+    if((!__base || __base == 16) && p[0] == CL('0') && (p[1] | 0x20) == CL('x') && __digit(p[2]) < 16) {
+        p += 2; __base = 16;
+    } else if(!__base)
+        __base = p[0] == CL('0') ? 8 : 10;
+    for(q = p; ; p++) {
+#ifndef UEFI_NO_UTF8
+        if(__base == 10 && v < 100000000000ULL && __swar_dec8(p, &t)) { v = v * 100000000 + t; p += 7; continue; }
+        if(__base == 16 && v < (1ULL << 32) && __swar_hex8(p, &t)) { v = (v << 32) | t; p += 7; continue; }
+#endif
+        d = __digit(*p);
+        if(d >= __base) break;
+        if(v > (~0ULL - d) / __base) *ovf = 1;
+        else v = v * __base + d;
     }
-    return strtol(s, NULL, 10) * sign;
+    if(p == q) return 0;
+    if(__endptr) *__endptr = (char_t*)p;
+    if(*ovf) errno = ERANGE;
+    return v;
 }
 
 int64_t strtol (const char_t *s, char_t **__endptr, int __base)
 {
-    int64_t v=0, sign = 1;
-    if(!s || !*s) return 0;
-    if(*s == CL('-')) { sign = -1; s++; }
-    while(!(*s < CL('0') || (__base < 10 && *s >= __base + CL('0')) || (__base >= 10 && ((*s > CL('9') && *s < CL('A')) ||
-            (*s > CL('F') && *s < CL('a')) || *s > CL('f'))))) {
-        v *= __base;
-        if(*s >= CL('0') && *s <= (__base < 10 ? __base + CL('0') : CL('9')))
-            v += (*s)-CL('0');
-        else if(__base == 16 && *s >= CL('a') && *s <= CL('f'))
-            v += (*s)-CL('a')+10;
-        else if(__base == 16 && *s >= CL('A') && *s <= CL('F'))
-            v += (*s)-CL('A')+10;
-        s++;
+    int neg, ovf;
+    uint64_t v = __strtou(s, __endptr, __base, &neg, &ovf);
+    if(ovf || v > 0x7fffffffffffffffULL + neg) {
+        errno = ERANGE;
+        return neg ? -0x7fffffffffffffffLL - 1 : 0x7fffffffffffffffLL;
+    }
+    return neg ? (int64_t)(0 - v) : (int64_t)v;
+}
+
+uint64_t strtoul (const char_t *s, char_t **__endptr, int __base)
+{
+    int neg, ovf;
+    uint64_t v = __strtou(s, __endptr, __base, &neg, &ovf);
+    return ovf ? ~0ULL : (neg ? 0 - v : v);
+}
+
+int64_t strtoll (const char_t *s, char_t **__endptr, int __base)
+{
+    return strtol(s, __endptr, __base);
+}
+
+uint64_t strtoull (const char_t *s, char_t **__endptr, int __base)
+{
+    return strtoul(s, __endptr, __base);
+}
+
+/* correctly rounded decimal to double conversion. Small numbers are converted exactly with one floating point operation,
+ * otherwise an approximation is corrected by comparing against the halfway points with big integers */
+#define STRTOD_MAXDIG 768
+typedef struct { int n; uint32_t d[168]; } __bignum_t;
+
+static void __bn_muladd(__bignum_t *a, uint32_t m, uint32_t c)
+{
+    uint64_t t;
+    int i;
+    for(i = 0; i < a->n; i++) {
+        t = (uint64_t)a->d[i] * m + c;
+        a->d[i] = (uint32_t)t;
+        c = (uint32_t)(t >> 32);
+    }
+    if(c) a->d[a->n++] = c;
+}
+
+static void __bn_pow5(__bignum_t *a, int e)
+{
+    static const uint32_t p5[] = { 1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125, 9765625, 48828125, 244140625 };
+    for(; e >= 13; e -= 13) __bn_muladd(a, 1220703125, 0);
+    if(e) __bn_muladd(a, p5[e], 0);
+}
+
+static void __bn_shl(__bignum_t *a, int s)
+{
+    int i, w = s >> 5, b = s & 31;
+    if(!a->n || !s) return;
+    a->d[a->n] = 0;
+    if(b) {
+        for(i = a->n; i > 0; i--) a->d[i] = (a->d[i] << b) | (a->d[i - 1] >> (32 - b));
+        a->d[0] <<= b;
+        if(a->d[a->n]) a->n++;
+    }
+    if(w) {
+        for(i = a->n - 1; i >= 0; i--) a->d[i + w] = a->d[i];
+        for(i = 0; i < w; i++) a->d[i] = 0;
+        a->n += w;
     }
+}
+
+/* compare digits * 10^E with h * 2^f */
+static int __strtod_cmp(const __bignum_t *m, int E, uint64_t h, int f)
+{
+    __bignum_t a, b;
+    int i;
+    for(a.n = m->n, i = 0; i < a.n; i++) a.d[i] = m->d[i];
+    b.n = 0;
+    if(h) { b.d[b.n++] = (uint32_t)h; if(h >> 32) b.d[b.n++] = (uint32_t)(h >> 32); }
+    if(E >= 0) __bn_pow5(&a, E); else __bn_pow5(&b, -E);
+    if(E > f) __bn_shl(&a, E - f); else __bn_shl(&b, f - E);
+    if(a.n != b.n) return a.n > b.n ? 1 : -1;
+    for(i = a.n - 1; i >= 0; i--)
+        if(a.d[i] != b.d[i]) return a.d[i] > b.d[i] ? 1 : -1;
+    return 0;
+}
+
+/* round a hexadecimal mantissa (plus sticky bit) times 2^e to double */
+static double __strtod_hex(uint64_t m, int e, int sticky)
+{
+    uint64_t q, r, h;
+    int s;
+    while(!(m >> 63)) { m <<= 1; e--; }
+    if(e + 63 > 1023) return 1.0 / 0.0;
+    s = e + 63 >= -1022 ? 11 : 11 + (-1022 - (e + 63));
+    if(s > 64) return 0.0;
+    q = s == 64 ? 0 : m >> s;
+    r = s == 64 ? m : m & ((1ULL << s) - 1);
+    h = 1ULL << (s - 1);
+    if(r > h || (r == h && (sticky || (q & 1)))) q++;
+    return ldexp((double)q, e + s);
+}
+
+static int __strtod_word(const char_t *p, const char *w)
+{
+    int i;
+    for(i = 0; w[i]; i++)
+        if((p[i] | 0x20) != (char_t)w[i]) return 0;
+    return i;
+}
+
+double strtod (const char_t *s, char_t **__endptr)
+{
+    static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+        1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    union { double d; uint64_t i; } u;
+    const char_t *p = s, *q;
+    char dig[STRTOD_MAXDIG + 2];
+    __bignum_t m;
+    uint64_t v = 0, mant;
+    int neg = 0, nd = 0, E = 0, ex = 0, frac = 0, any = 0, sticky = 0, esign, i, f;
+
     if(__endptr) *__endptr = (char_t*)s;
-    return v * sign;
+    if(!s) return 0.0;
+    while(*p == CL(' ') || (*p >= CL('\t') && *p <= CL('\r'))) p++;
+    if(*p == CL('-') || *p == CL('+')) neg = *p++ == CL('-');
+    if((i = __strtod_word(p, "inf"))) {
+        p += i;
+        if((i = __strtod_word(p, "inity"))) p += i;
+        u.d = 1.0 / 0.0;
+        goto done;
+    }
+    if((i = __strtod_word(p, "nan"))) {
+        p += i;
+        if(*p == CL('(')) {
+            for(q = p + 1; *q == CL('_') || __digit(*q) < 36; q++);
+            if(*q == CL(')')) p = q + 1;
+        }
+        u.d = 0.0 / 0.0;
+        goto done;
+    }
+    if(p[0] == CL('0') && (p[1] | 0x20) == CL('x') && (__digit(p[2]) < 16 || (p[2] == CL('.') && __digit(p[3]) < 16))) {
+        /* hexadecimal float, 16 significant digits plus sticky bit */
+        for(p += 2, mant = 0; ; p++) {
+            if(*p == CL('.') && !frac) { frac = 1; continue; }
+            if((i = __digit(*p)) >= 16) break;
+            if(mant >> 60) { if(i) sticky = 1; if(!frac) ex += 4; }
+            else { mant = (mant << 4) | i; if(frac) ex -= 4; }
+        }
+        if((*p | 0x20) == CL('p')) {
+            q = p + 1; esign = 0;
+            if(*q == CL('-') || *q == CL('+')) esign = *q++ == CL('-');
+            if(*q >= CL('0') && *q <= CL('9')) {
+                for(E = 0; *q >= CL('0') && *q <= CL('9'); q++) if(E < 100000) E = E * 10 + *q - CL('0');
+                ex += esign ? -E : E;
+                p = q;
+            }
+        }
+        u.d = mant ? __strtod_hex(mant, ex, sticky) : 0.0;
+        if(mant && (u.d == 0.0 || u.d == 1.0 / 0.0)) errno = ERANGE;
+        goto done;
+    }
+    /* collect the significant digits */
+    for(; ; p++) {
+        if(*p == CL('.') && !frac) { frac = 1; continue; }
+        if(*p < CL('0') || *p > CL('9')) break;
+        any = 1;
+        if(!nd && *p == CL('0')) { if(frac) E--; continue; }
+        if(nd < STRTOD_MAXDIG) { dig[nd++] = (char)*p; if(frac) E--; }
+        else { if(*p != CL('0')) sticky = 1; if(!frac) E++; }
+    }
+    if(!any) return 0.0;
+    if((*p | 0x20) == CL('e')) {
+        q = p + 1; esign = 0;
+        if(*q == CL('-') || *q == CL('+')) esign = *q++ == CL('-');
+        if(*q >= CL('0') && *q <= CL('9')) {
+            for(ex = 0; *q >= CL('0') && *q <= CL('9'); q++) if(ex < 100000) ex = ex * 10 + *q - CL('0');
+            E += esign ? -ex : ex;
+            p = q;
+        }
+    }
+    /* truncated digits only matter in that the value is above the kept ones */
+    if(sticky) { dig[nd++] = '1'; E--; }
+    while(nd && dig[nd - 1] == '0') { nd--; E++; }
+    if(!nd) { u.d = 0.0; goto done; }
+    if(nd + E - 1 > 309) { u.d = 1.0 / 0.0; errno = ERANGE; goto done; }
+    if(nd + E - 1 < -324) { u.d = 0.0; errno = ERANGE; goto done; }
+    if(nd <= 19)
+        for(i = 0; i < nd; i++) v = v * 10 + dig[i] - '0';
+    if(nd <= 15 && E >= -22 && E <= 22 + 15 - nd) {
+        /* exact, both the mantissa and the power of ten are representable */
+        u.d = (double)v;
+        if(E > 22) { u.d *= p10[E - 22]; E = 22; }
+        u.d = E < 0 ? u.d / p10[-E] : u.d * p10[E];
+        goto done;
+    }
+    /* approximation from the first 19 digits */
+    if(nd > 19)
+        for(i = 0; i < 19; i++) v = v * 10 + dig[i] - '0';
+    ex = E + (nd > 19 ? nd - 19 : 0);
+    u.d = (double)v;
+    for(; ex > 22; ex -= 22) u.d *= 1e22;
+    for(; ex < -22; ex += 22) u.d /= 1e22;
+    u.d = ex < 0 ? u.d / p10[-ex] : u.d * p10[ex];
+    if(u.i >= 0x7ff0000000000000ULL) u.i = 0x7fefffffffffffffULL;
+    /* correct it */
+    m.n = 0;
+    for(i = 0; i < nd; i++) __bn_muladd(&m, 10, dig[i] - '0');
+    while(1) {
+        f = (int)(u.i >> 52);
+        mant = u.i & ((1ULL << 52) - 1);
+        if(f) mant |= 1ULL << 52; else f = 1;
+        f -= 1075;
+        i = __strtod_cmp(&m, E, 2 * mant + 1, f - 1);
+        if(i > 0 || (!i && (mant & 1))) { u.i++; if(u.i == 0x7ff0000000000000ULL) break; continue; }
+        if(!mant) break;
+        i = mant == 1ULL << 52 && f > -1074 ? __strtod_cmp(&m, E, 4 * mant - 1, f - 2) : __strtod_cmp(&m, E, 2 * mant - 1, f - 1);
+        if(i < 0 || (!i && (mant & 1))) { u.i--; continue; }
+        break;
+    }
+    if(u.d == 0.0 || u.i == 0x7ff0000000000000ULL) errno = ERANGE;
+done:
+    if(__endptr) *__endptr = (char_t*)p;
+    return neg ? -u.d : u.d;
+}
+
+double atof(const char_t *s)
+{
+    return strtod(s, NULL);
 }
 
 void *malloc (size_t __size)
@@ -308,26 +586,183 @@ size_t wcstombs (char *__s, const wchar_t *__pwcs, size_t __n)
     return (size_t)(__s - orig);
 }
 
-void srand(unsigned int __seed)
+/* random number generator, a ChaCha20 keystream (same construction as OpenBSD's arc4random). The firmware is only
+ * asked for entropy when the key is stirred, everything else is generated in batches of RND_BUFSZ bytes */
+#define RND_KEYSZ   32
+#define RND_IVSZ    8
+#define RND_BLKSZ   64
+#define RND_BUFSZ   (16 * RND_BLKSZ)
+#define RND_RESEED  1600000
+#define RND_ROTL(v,n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define RND_QR(a,b,c,d) \
+    a += b; d = RND_ROTL(d ^ a, 16); c += d; b = RND_ROTL(b ^ c, 12); \
+    a += b; d = RND_ROTL(d ^ a, 8);  c += d; b = RND_ROTL(b ^ c, 7)
+static uint32_t __rnd_ctx[16];
+static uint8_t __rnd_buf[RND_BUFSZ];
+static uintn_t __rnd_have = 0, __rnd_count = 0;
+static efi_rng_protocol_t *__rnd_rng = NULL;
+static int __rnd_init = 0, __rnd_hw = -1;
+
+static void __rnd_keysetup(const uint8_t *key)
 {
-    __srand_seed = __seed - 1;
+    int i;
+    /* "expand 32-byte k" */
+    __rnd_ctx[0] = 0x61707865; __rnd_ctx[1] = 0x3320646e; __rnd_ctx[2] = 0x79622d32; __rnd_ctx[3] = 0x6b206574;
+    for(i = 0; i < 8; i++)
+        __rnd_ctx[4 + i] = (uint32_t)key[i*4] | ((uint32_t)key[i*4+1] << 8) | ((uint32_t)key[i*4+2] << 16) |
+            ((uint32_t)key[i*4+3] << 24);
+    __rnd_ctx[12] = __rnd_ctx[13] = 0;
+    for(i = 0; i < 2; i++)
+        __rnd_ctx[14 + i] = (uint32_t)key[RND_KEYSZ+i*4] | ((uint32_t)key[RND_KEYSZ+i*4+1] << 8) |
+            ((uint32_t)key[RND_KEYSZ+i*4+2] << 16) | ((uint32_t)key[RND_KEYSZ+i*4+3] << 24);
 }
 
-int rand()
+static void __rnd_keystream(uint8_t *dst, uintn_t n)
+{
+    uint32_t x[16];
+    int i;
+    for(; n >= RND_BLKSZ; n -= RND_BLKSZ, dst += RND_BLKSZ) {
+        memcpy(x, __rnd_ctx, sizeof(x));
+        for(i = 0; i < 10; i++) {
+            RND_QR(x[0], x[4], x[8],  x[12]); RND_QR(x[1], x[5], x[9],  x[13]);
+            RND_QR(x[2], x[6], x[10], x[14]); RND_QR(x[3], x[7], x[11], x[15]);
+            RND_QR(x[0], x[5], x[10], x[15]); RND_QR(x[1], x[6], x[11], x[12]);
+            RND_QR(x[2], x[7], x[8],  x[13]); RND_QR(x[3], x[4], x[9],  x[14]);
+        }
+        for(i = 0; i < 16; i++) {
+            x[i] += __rnd_ctx[i];
+            dst[i*4] = (uint8_t)x[i]; dst[i*4+1] = (uint8_t)(x[i] >> 8);
+            dst[i*4+2] = (uint8_t)(x[i] >> 16); dst[i*4+3] = (uint8_t)(x[i] >> 24);
+        }
+        if(!++__rnd_ctx[12]) __rnd_ctx[13]++;
+    }
+}
+
+/* generate a new batch, and immediately replace the key with the beginning of it, so that earlier output can't be
+ * reconstructed. Optional data (fresh entropy or a seed) is mixed into the new key */
+static void __rnd_rekey(const uint8_t *dat, uintn_t datlen)
+{
+    uintn_t i;
+    __rnd_keystream(__rnd_buf, RND_BUFSZ);
+    if(dat)
+        for(i = 0; i < datlen && i < RND_KEYSZ + RND_IVSZ; i++)
+            __rnd_buf[i] ^= dat[i];
+    __rnd_keysetup(__rnd_buf);
+    memset(__rnd_buf, 0, RND_KEYSZ + RND_IVSZ);
+    __rnd_have = RND_BUFSZ - RND_KEYSZ - RND_IVSZ;
+}
+
+/* collect entropy for a new key. The protocol is looked up only once, and whatever the firmware and the CPU
+ * provides is xor'd together, so a missing or weak source doesn't make the key predictable */
+static void __rnd_stir(void)
 {
     efi_guid_t rngGuid = EFI_RNG_PROTOCOL_GUID;
-    efi_rng_protocol_t *rng = NULL;
-    efi_status_t status;
-    int ret = 0;
+    uint64_t r[(RND_KEYSZ + RND_IVSZ) / 8], v;
+    uintn_t i;
+#ifdef __x86_64__
+    uint32_t a, b, c, d;
+    uint8_t ok;
+    int j;
+#endif
 
-    __srand_seed = 6364136223846793005ULL*__srand_seed + 1;
-    status = BS->LocateProtocol(&rngGuid, NULL, (void**)&rng);
-    if(!EFI_ERROR(status) && rng)
-        rng->GetRNG(rng, NULL, (uintn_t)sizeof(int), (uint8_t*)&ret);
-    ret ^= (int)(__srand_seed>>33);
+    memset(r, 0, sizeof(r));
+    if(!__rnd_init) {
+        if(EFI_ERROR(BS->LocateProtocol(&rngGuid, NULL, (void**)&__rnd_rng)))
+            __rnd_rng = NULL;
+#ifdef __x86_64__
+        /* 1 = RDRAND, 2 = RDSEED */
+        __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+        __rnd_hw = (c >> 30) & 1;
+        __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0), "c"(0));
+        if(a >= 7) {
+            __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+            if(b & (1 << 18)) __rnd_hw = 2;
+        }
+#else
+        __rnd_hw = 0;
+#endif
+    }
+    if(__rnd_rng)
+        __rnd_rng->GetRNG(__rnd_rng, NULL, sizeof(r), (uint8_t*)r);
+    for(i = 0; i < sizeof(r) / sizeof(uint64_t); i++) {
+#ifdef __x86_64__
+        if(__rnd_hw > 0)
+            for(j = 0; j < 10; j++) {
+                if(__rnd_hw == 2) __asm__ __volatile__("rdseed %0; setc %1" : "=r"(v), "=qm"(ok) :: "cc");
+                else __asm__ __volatile__("rdrand %0; setc %1" : "=r"(v), "=qm"(ok) :: "cc");
+                if(ok) { r[i] ^= v; break; }
+            }
+        __asm__ __volatile__("rdtsc" : "=a"(a), "=d"(d));
+        r[i] ^= ((uint64_t)d << 32) | a;
+#endif
+        v = 0;
+        BS->GetNextHighMonotonicCount(&v);
+        r[i] ^= v * 0x9E3779B97F4A7C15ULL;
+    }
+    if(!__rnd_init) {
+        __rnd_keysetup((uint8_t*)r);
+        __rnd_init = 1;
+    }
+    __rnd_rekey((uint8_t*)r, sizeof(r));
+    memset(r, 0, sizeof(r));
+    memset(__rnd_buf, 0, sizeof(__rnd_buf));
+    __rnd_have = 0;
+    __rnd_count = RND_RESEED;
+}
+
+void arc4random_buf(void *__buf, size_t __n)
+{
+    uint8_t *dst = (uint8_t*)__buf;
+    uintn_t m;
+    if(!__buf) return;
+    if(!__rnd_init || __rnd_count <= __n) __rnd_stir();
+    __rnd_count = __rnd_count > __n ? __rnd_count - __n : 0;
+    while(__n > 0) {
+        if(__rnd_have > 0) {
+            m = __n < __rnd_have ? __n : __rnd_have;
+            /* hand out the batch from its end, and wipe what has been given away */
+            memcpy(dst, __rnd_buf + RND_BUFSZ - __rnd_have, m);
+            memset(__rnd_buf + RND_BUFSZ - __rnd_have, 0, m);
+            dst += m; __n -= m; __rnd_have -= m;
+        }
+        if(!__rnd_have) __rnd_rekey(NULL, 0);
+    }
+}
+
+uint32_t arc4random(void)
+{
+    uint32_t ret;
+    if(!__rnd_init || __rnd_count <= sizeof(ret)) __rnd_stir();
+    __rnd_count -= sizeof(ret);
+    if(__rnd_have < sizeof(ret)) __rnd_rekey(NULL, 0);
+    memcpy(&ret, __rnd_buf + RND_BUFSZ - __rnd_have, sizeof(ret));
+    memset(__rnd_buf + RND_BUFSZ - __rnd_have, 0, sizeof(ret));
+    __rnd_have -= sizeof(ret);
     return ret;
 }
 
+uint32_t arc4random_uniform(uint32_t __upper_bound)
+{
+    uint32_t r, min;
+    if(__upper_bound < 2) return 0;
+    /* 2**32 % x == (2**32 - x) % x, reject values below that to avoid modulo bias */
+    min = -__upper_bound % __upper_bound;
+    do { r = arc4random(); } while(r < min);
+    return r % __upper_bound;
+}
+
+void srand(unsigned int __seed)
+{
+    /* this only stirs the seed into the generator, it does not make the sequence reproducible */
+    if(!__rnd_init) __rnd_stir();
+    __rnd_rekey((uint8_t*)&__seed, sizeof(__seed));
+}
+
+int rand()
+{
+    return (int)(arc4random() & RAND_MAX);
+}
+
 uint8_t *getenv(char_t *name, uintn_t *len)
 {
     efi_guid_t globGuid = EFI_GLOBAL_VARIABLE;
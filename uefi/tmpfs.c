@@ -0,0 +1,567 @@
+/*
+ * tmpfs.c
+ *
+ * Copyright (C) 2021 bzt (bztsrc@gitlab)
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * This file is part of the POSIX-UEFI package.
+ * @brief RAM file system for the /tmp/ directory
+ *
+ */
+
+#include <uefi.h>
+
+/* This is an implementation of the file protocol, so stdio, dirent and stat handle it just like the volumes provided
+ * by the firmware. Files are lists of extents, so they grow without copying, and directories hash their entries */
+
+#define __TMP_EXTMIN    4096                /* extents double from this size... */
+#define __TMP_EXTMAX    (1024 * 1024)       /* ...up to this */
+#define __TMP_HASHMIN   16
+#define __TMP_INFOSIZE  ((uintn_t)&((efi_file_info_t*)0)->FileName)
+
+typedef struct __tmpnode_s __tmpnode_t;
+struct __tmpnode_s {
+    __tmpnode_t *parent;            /* NULL for the root and for removed nodes */
+    __tmpnode_t *hnext;             /* next in the parent's hash bucket */
+    __tmpnode_t *prev, *next;       /* the parent's entries in creation order, for reading the directory */
+    uintn_t refs;                   /* open handles, plus one while linked in a directory */
+    uint64_t attr;
+    efi_time_t ctime, mtime;
+    /* files */
+    uint64_t size;
+    uint8_t **ext;                  /* extents, NULL if that part was never written */
+    uintn_t nexts;                  /* number of extent slots */
+    /* directories */
+    __tmpnode_t **tab, *first, *last;
+    uintn_t nbuck, nent;
+    uintn_t gen;                    /* changes whenever an entry is removed */
+    uintn_t len;
+    wchar_t *name;
+};
+
+typedef struct {
+    efi_file_handle_t fh;           /* must be the first, handles are passed around as efi_file_handle_t */
+    __tmpnode_t *node;
+    uint64_t pos;                   /* byte offset in files, entry index in directories */
+    uint64_t mode;
+    int dirty;                      /* written to, the modification time is updated on close */
+    __tmpnode_t *cur;               /* directories, the entry at pos, valid if gen matches */
+    uintn_t gen;
+} __tmpfh_t;
+
+static __tmpnode_t *__tmp_root = NULL;
+static efi_file_handle_t *__tmp_handle(__tmpnode_t *node, uint64_t mode);
+
+static void __tmp_now(efi_time_t *t)
+{
+    memset(t, 0, sizeof(efi_time_t));
+    if(RT && RT->GetTime) RT->GetTime(t, NULL);
+}
+
+static uintn_t __tmp_hash(const wchar_t *s, uintn_t len)
+{
+    uint32_t h = 2166136261U;
+    for(; len; len--, s++)
+        h = (h ^ (uint32_t)*s) * 16777619U;
+    return h;
+}
+
+static __tmpnode_t *__tmp_lookup(__tmpnode_t *dir, const wchar_t *name, uintn_t len)
+{
+    __tmpnode_t *n;
+    if(!dir->nbuck) return NULL;
+    for(n = dir->tab[__tmp_hash(name, len) & (dir->nbuck - 1)]; n; n = n->hnext)
+        if(n->len == len && !memcmp(n->name, name, len * sizeof(wchar_t)))
+            return n;
+    return NULL;
+}
+
+/* add an entry to a directory, the hash table doubles when it gets twice as many entries as buckets */
+static int __tmp_link(__tmpnode_t *dir, __tmpnode_t *node)
+{
+    __tmpnode_t **tab, *n;
+    uintn_t i, h;
+    if(dir->nent >= 2 * dir->nbuck) {
+        i = dir->nbuck ? 2 * dir->nbuck : __TMP_HASHMIN;
+        if(!(tab = (__tmpnode_t**)malloc(i * sizeof(__tmpnode_t*)))) {
+            if(!dir->nbuck) return 0;
+        } else {
+            memset(tab, 0, i * sizeof(__tmpnode_t*));
+            for(n = dir->first; n; n = n->next) {
+                h = __tmp_hash(n->name, n->len) & (i - 1);
+                n->hnext = tab[h];
+                tab[h] = n;
+            }
+            if(dir->tab) free(dir->tab);
+            dir->tab = tab;
+            dir->nbuck = i;
+        }
+    }
+    h = __tmp_hash(node->name, node->len) & (dir->nbuck - 1);
+    node->hnext = dir->tab[h];
+    dir->tab[h] = node;
+    node->prev = dir->last;
+    node->next = NULL;
+    if(dir->last) dir->last->next = node;
+    else dir->first = node;
+    dir->last = node;
+    dir->nent++;
+    node->parent = dir;
+    node->refs++;
+    return 1;
+}
+
+static void __tmp_unlink(__tmpnode_t *node)
+{
+    __tmpnode_t *dir = node->parent, **p;
+    for(p = &dir->tab[__tmp_hash(node->name, node->len) & (dir->nbuck - 1)]; *p && *p != node; p = &(*p)->hnext);
+    if(*p) *p = node->hnext;
+    if(node->prev) node->prev->next = node->next;
+    else dir->first = node->next;
+    if(node->next) node->next->prev = node->prev;
+    else dir->last = node->prev;
+    dir->nent--;
+    dir->gen++;
+    node->parent = node->hnext = node->prev = node->next = NULL;
+    node->refs--;
+}
+
+static __tmpnode_t *__tmp_new(const wchar_t *name, uintn_t len, uint64_t attr)
+{
+    __tmpnode_t *node = (__tmpnode_t*)malloc(sizeof(__tmpnode_t));
+    if(!node) return NULL;
+    memset(node, 0, sizeof(__tmpnode_t));
+    if(!(node->name = (wchar_t*)malloc((len + 1) * sizeof(wchar_t)))) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->name, name, len * sizeof(wchar_t));
+    node->name[len] = 0;
+    node->len = len;
+    node->attr = attr;
+    __tmp_now(&node->ctime);
+    memcpy(&node->mtime, &node->ctime, sizeof(efi_time_t));
+    return node;
+}
+
+/* free a node and everything below it */
+static void __tmp_free(__tmpnode_t *node)
+{
+    __tmpnode_t *n, *next;
+    uintn_t i;
+    for(n = node->first; n; n = next) {
+        next = n->next;
+        __tmp_free(n);
+    }
+    for(i = 0; i < node->nexts; i++)
+        if(node->ext[i]) free(node->ext[i]);
+    if(node->ext) free(node->ext);
+    if(node->tab) free(node->tab);
+    free(node->name);
+    free(node);
+}
+
+static void __tmp_release(__tmpnode_t *node)
+{
+    if(!--node->refs)
+        __tmp_free(node);
+}
+
+/* the extent of a file offset, returns its index and the offset and size within */
+static uintn_t __tmp_ext(uint64_t off, uintn_t *o, uintn_t *size)
+{
+    uintn_t i, s;
+    for(i = 0, s = __TMP_EXTMIN; s < __TMP_EXTMAX && off >= s; i++, s <<= 1)
+        off -= s;
+    if(s == __TMP_EXTMAX) {
+        i += off / s;
+        off %= s;
+    }
+    *o = (uintn_t)off;
+    *size = s;
+    return i;
+}
+
+/* copy from or to a file's extents. Holes read as zeros, and the bytes past the end of file are always kept zero, so
+ * that growing the file doesn't need to clear anything. Returns the number of bytes done */
+static uintn_t __tmp_rw(__tmpnode_t *node, uint64_t pos, uint8_t *buf, uintn_t n, int write)
+{
+    uintn_t i, o, sz, len, done = 0;
+    uint8_t **ext;
+    while(done < n) {
+        i = __tmp_ext(pos, &o, &sz);
+        len = sz - o < n - done ? sz - o : n - done;
+        if(write) {
+            if(i >= node->nexts) {
+                if(!(ext = (uint8_t**)realloc(node->ext, (i + node->nexts + 1) * sizeof(uint8_t*)))) break;
+                memset(ext + node->nexts, 0, (i + 1) * sizeof(uint8_t*));
+                node->ext = ext;
+                node->nexts += i + 1;
+            }
+            if(!node->ext[i]) {
+                if(!(node->ext[i] = (uint8_t*)malloc(sz))) break;
+                if(o || len < sz) memset(node->ext[i], 0, sz);
+            }
+            memcpy(node->ext[i] + o, buf + done, len);
+        } else
+        if(i < node->nexts && node->ext[i])
+            memcpy(buf + done, node->ext[i] + o, len);
+        else
+            memset(buf + done, 0, len);
+        done += len;
+        pos += len;
+    }
+    return done;
+}
+
+/* change the file size, freeing the extents past the end */
+static void __tmp_truncate(__tmpnode_t *node, uint64_t size)
+{
+    uintn_t i, o, sz;
+    if(size < node->size) {
+        i = __tmp_ext(size, &o, &sz);
+        if(o && i < node->nexts && node->ext[i])
+            memset(node->ext[i] + o, 0, sz - o);
+        for(i = o ? i + 1 : i; i < node->nexts; i++)
+            if(node->ext[i]) {
+                free(node->ext[i]);
+                node->ext[i] = NULL;
+            }
+    }
+    node->size = size;
+}
+
+static void __tmp_info(__tmpnode_t *node, efi_file_info_t *info)
+{
+    uintn_t i;
+    memset(info, 0, __TMP_INFOSIZE);
+    info->Size = __TMP_INFOSIZE + (node->len + 1) * sizeof(wchar_t);
+    info->FileSize = node->size;
+    for(i = 0; i < node->nexts; i++)
+        if(node->ext[i])
+            info->PhysicalSize += i < 8 ? (uint64_t)__TMP_EXTMIN << i : __TMP_EXTMAX;
+    memcpy(&info->CreateTime, &node->ctime, sizeof(efi_time_t));
+    memcpy(&info->LastAccessTime, &node->mtime, sizeof(efi_time_t));
+    memcpy(&info->ModificationTime, &node->mtime, sizeof(efi_time_t));
+    info->Attribute = node->attr;
+    memcpy(info->FileName, node->name, (node->len + 1) * sizeof(wchar_t));
+}
+
+/* find the directory of the last component in a path, which can be absolute or relative to dir */
+static __tmpnode_t *__tmp_path(__tmpnode_t *dir, wchar_t *path, wchar_t **name, uintn_t *len)
+{
+    wchar_t *s = path, *e;
+    __tmpnode_t *n;
+    if(*s == L'\\' || *s == L'/') dir = __tmp_root;
+    *name = NULL;
+    *len = 0;
+    for(;;) {
+        while(*s == L'\\' || *s == L'/') s++;
+        if(!*s) return dir;
+        for(e = s; *e && *e != L'\\' && *e != L'/'; e++);
+        if(!(dir->attr & EFI_FILE_DIRECTORY)) return NULL;
+        /* check if this is the last component */
+        for(path = e; *path == L'\\' || *path == L'/'; path++);
+        if(!*path && !(e - s == 1 && s[0] == L'.') && !(e - s == 2 && s[0] == L'.' && s[1] == L'.')) {
+            *name = s;
+            *len = (uintn_t)(e - s);
+            return dir;
+        }
+        if(e - s == 2 && s[0] == L'.' && s[1] == L'.') {
+            if(dir->parent) dir = dir->parent;
+        } else
+        if(e - s != 1 || s[0] != L'.') {
+            if(!(n = __tmp_lookup(dir, s, (uintn_t)(e - s)))) return NULL;
+            dir = n;
+        }
+        s = e;
+    }
+}
+
+static efi_status_t EFIAPI __tmp_open(efi_file_handle_t *File, efi_file_handle_t **NewHandle, wchar_t *FileName,
+    uint64_t OpenMode, uint64_t Attributes)
+{
+    __tmpnode_t *dir, *node;
+    wchar_t *name;
+    uintn_t len;
+    if(!File || !NewHandle || !FileName)
+        return EFI_INVALID_PARAMETER;
+    if(!(dir = __tmp_path(((__tmpfh_t*)File)->node, FileName, &name, &len)))
+        return EFI_NOT_FOUND;
+    if(!name)
+        node = dir;
+    else
+    if(!(node = __tmp_lookup(dir, name, len))) {
+        if(!(OpenMode & EFI_FILE_MODE_CREATE))
+            return EFI_NOT_FOUND;
+        /* a removed directory can't get new entries */
+        if(len >= FILENAME_MAX || (dir != __tmp_root && !dir->parent))
+            return EFI_ACCESS_DENIED;
+        if(!(node = __tmp_new(name, len, Attributes & EFI_FILE_VALID_ATTR)))
+            return EFI_OUT_OF_RESOURCES;
+        if(!__tmp_link(dir, node)) {
+            __tmp_free(node);
+            return EFI_OUT_OF_RESOURCES;
+        }
+        __tmp_now(&dir->mtime);
+    } else
+    if((OpenMode & EFI_FILE_MODE_WRITE) && (node->attr & EFI_FILE_READ_ONLY))
+        return EFI_ACCESS_DENIED;
+    *NewHandle = __tmp_handle(node, OpenMode);
+    return *NewHandle ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+static efi_status_t EFIAPI __tmp_close(efi_file_handle_t *File)
+{
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    if(!h) return EFI_INVALID_PARAMETER;
+    if(h->dirty) __tmp_now(&h->node->mtime);
+    __tmp_release(h->node);
+    free(h);
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_delete(efi_file_handle_t *File)
+{
+    __tmpnode_t *node = ((__tmpfh_t*)File)->node;
+    /* like the FAT driver, the handle is closed even if the node can't be removed */
+    if(node == __tmp_root || node->nent || !(((__tmpfh_t*)File)->mode & EFI_FILE_MODE_WRITE)) {
+        __tmp_close(File);
+        return EFI_WARN_DELETE_FAILURE;
+    }
+    if(node->parent) {
+        __tmp_now(&node->parent->mtime);
+        __tmp_unlink(node);
+    }
+    return __tmp_close(File);
+}
+
+static efi_status_t EFIAPI __tmp_read(efi_file_handle_t *File, uintn_t *BufferSize, void *Buffer)
+{
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    __tmpnode_t *node = h->node;
+    uint64_t i;
+    uintn_t n;
+    if(!BufferSize || (*BufferSize && !Buffer))
+        return EFI_INVALID_PARAMETER;
+    if(node->attr & EFI_FILE_DIRECTORY) {
+        /* continue from the cursor if no entry was removed since */
+        if(!h->cur || h->gen != node->gen)
+            for(h->cur = node->first, i = 0; h->cur && i < h->pos; i++)
+                h->cur = h->cur->next;
+        h->gen = node->gen;
+        if(!h->cur) {
+            *BufferSize = 0;
+            return EFI_SUCCESS;
+        }
+        n = __TMP_INFOSIZE + (h->cur->len + 1) * sizeof(wchar_t);
+        if(*BufferSize < n) {
+            *BufferSize = n;
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        __tmp_info(h->cur, (efi_file_info_t*)Buffer);
+        *BufferSize = n;
+        h->cur = h->cur->next;
+        h->pos++;
+        return EFI_SUCCESS;
+    }
+    if(h->pos > node->size)
+        return EFI_DEVICE_ERROR;
+    if(*BufferSize > node->size - h->pos)
+        *BufferSize = (uintn_t)(node->size - h->pos);
+    h->pos += __tmp_rw(node, h->pos, (uint8_t*)Buffer, *BufferSize, 0);
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_write(efi_file_handle_t *File, uintn_t *BufferSize, void *Buffer)
+{
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    uintn_t n;
+    if(!BufferSize || (*BufferSize && !Buffer))
+        return EFI_INVALID_PARAMETER;
+    if(h->node->attr & EFI_FILE_DIRECTORY)
+        return EFI_UNSUPPORTED;
+    if(!(h->mode & EFI_FILE_MODE_WRITE))
+        return EFI_ACCESS_DENIED;
+    n = __tmp_rw(h->node, h->pos, (uint8_t*)Buffer, *BufferSize, 1);
+    h->pos += n;
+    if(h->pos > h->node->size) h->node->size = h->pos;
+    h->dirty = 1;
+    if(n < *BufferSize) {
+        *BufferSize = n;
+        return EFI_VOLUME_FULL;
+    }
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_getpos(efi_file_handle_t *File, uint64_t *Position)
+{
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    if(!Position)
+        return EFI_INVALID_PARAMETER;
+    if(h->node->attr & EFI_FILE_DIRECTORY)
+        return EFI_UNSUPPORTED;
+    *Position = h->pos;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_setpos(efi_file_handle_t *File, uint64_t Position)
+{
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    if(h->node->attr & EFI_FILE_DIRECTORY) {
+        /* directories can only be rewound */
+        if(Position)
+            return EFI_UNSUPPORTED;
+        h->cur = NULL;
+    }
+    h->pos = Position == (uint64_t)-1 ? h->node->size : Position;
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_getinfo(efi_file_handle_t *File, efi_guid_t *InformationType, uintn_t *BufferSize,
+    void *Buffer)
+{
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    __tmpnode_t *node = ((__tmpfh_t*)File)->node;
+    uintn_t n;
+    if(!InformationType || !BufferSize)
+        return EFI_INVALID_PARAMETER;
+    if(memcmp(InformationType, &infGuid, sizeof(efi_guid_t)))
+        return EFI_UNSUPPORTED;
+    n = __TMP_INFOSIZE + (node->len + 1) * sizeof(wchar_t);
+    if(*BufferSize < n || !Buffer) {
+        *BufferSize = n;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    __tmp_info(node, (efi_file_info_t*)Buffer);
+    *BufferSize = n;
+    return EFI_SUCCESS;
+}
+
+/* set size, attributes, times, or rename. A name with a path moves the node to another directory */
+static efi_status_t EFIAPI __tmp_setinfo(efi_file_handle_t *File, efi_guid_t *InformationType, uintn_t BufferSize,
+    void *Buffer)
+{
+    efi_guid_t infGuid = EFI_FILE_INFO_GUID;
+    efi_file_info_t *info = (efi_file_info_t*)Buffer;
+    __tmpfh_t *h = (__tmpfh_t*)File;
+    __tmpnode_t *node = h->node, *dir, *n, *old;
+    wchar_t *name, *newname;
+    uintn_t len;
+    if(!InformationType || !Buffer || BufferSize < __TMP_INFOSIZE + sizeof(wchar_t))
+        return EFI_INVALID_PARAMETER;
+    if(memcmp(InformationType, &infGuid, sizeof(efi_guid_t)))
+        return EFI_UNSUPPORTED;
+    if((info->Attribute & EFI_FILE_DIRECTORY) != (node->attr & EFI_FILE_DIRECTORY) ||
+        (info->FileSize != node->size && ((node->attr & EFI_FILE_DIRECTORY) || !(h->mode & EFI_FILE_MODE_WRITE))))
+        return EFI_ACCESS_DENIED;
+    for(len = 0; len < node->len && info->FileName[len] == node->name[len]; len++);
+    if(len != node->len || info->FileName[len]) {
+        if(!node->parent)
+            return EFI_ACCESS_DENIED;
+        if(!(dir = __tmp_path(node->parent, info->FileName, &name, &len)) || !name || len >= FILENAME_MAX)
+            return EFI_NOT_FOUND;
+        if((old = __tmp_lookup(dir, name, len)) && old != node)
+            return EFI_ACCESS_DENIED;
+        /* a directory can't be moved into itself */
+        for(n = dir; n; n = n->parent)
+            if(n == node) return EFI_ACCESS_DENIED;
+        if(!(newname = (wchar_t*)malloc((len + 1) * sizeof(wchar_t))))
+            return EFI_OUT_OF_RESOURCES;
+        memcpy(newname, name, len * sizeof(wchar_t));
+        newname[len] = 0;
+        old = node->parent;
+        __tmp_unlink(node);
+        free(node->name);
+        node->name = newname;
+        node->len = len;
+        /* the table never shrinks, so relinking into the old directory can't fail */
+        if(!__tmp_link(dir, node)) {
+            __tmp_link(old, node);
+            return EFI_OUT_OF_RESOURCES;
+        }
+        __tmp_now(&old->mtime);
+        __tmp_now(&dir->mtime);
+    }
+    if(info->FileSize != node->size) {
+        __tmp_truncate(node, info->FileSize);
+        h->dirty = 1;
+    }
+    node->attr = (node->attr & EFI_FILE_DIRECTORY) | (info->Attribute & EFI_FILE_VALID_ATTR & ~EFI_FILE_DIRECTORY);
+    /* zero times are left as they are */
+    if(info->CreateTime.Year)
+        memcpy(&node->ctime, &info->CreateTime, sizeof(efi_time_t));
+    if(info->ModificationTime.Year) {
+        memcpy(&node->mtime, &info->ModificationTime, sizeof(efi_time_t));
+        h->dirty = 0;
+    }
+    return EFI_SUCCESS;
+}
+
+static efi_status_t EFIAPI __tmp_flush(efi_file_handle_t *File)
+{
+    (void)File;
+    return EFI_SUCCESS;
+}
+
+static efi_file_handle_t *__tmp_handle(__tmpnode_t *node, uint64_t mode)
+{
+    __tmpfh_t *h = (__tmpfh_t*)malloc(sizeof(__tmpfh_t));
+    if(!h) return NULL;
+    memset(h, 0, sizeof(__tmpfh_t));
+    h->fh.Revision = EFI_FILE_PROTOCOL_REVISION;
+    h->fh.Open = __tmp_open;
+    h->fh.Close = __tmp_close;
+    h->fh.Delete = __tmp_delete;
+    h->fh.Read = __tmp_read;
+    h->fh.Write = __tmp_write;
+    h->fh.GetPosition = __tmp_getpos;
+    h->fh.SetPosition = __tmp_setpos;
+    h->fh.GetInfo = __tmp_getinfo;
+    h->fh.SetInfo = __tmp_setinfo;
+    h->fh.Flush = __tmp_flush;
+    h->node = node;
+    h->mode = mode;
+    node->refs++;
+    return &h->fh;
+}
+
+/* returns a new handle to the root directory, the file system is created on first use */
+efi_file_handle_t *__tmpfs_root(void)
+{
+    if(!__tmp_root) {
+        if(!(__tmp_root = __tmp_new(L"", 0, EFI_FILE_DIRECTORY)))
+            return NULL;
+        /* the root is never freed by closing its handles */
+        __tmp_root->refs = 1;
+    }
+    return __tmp_handle(__tmp_root, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE);
+}
+
+/* called on exit, everything is gone, even the files still open */
+void __tmpfs_free(void)
+{
+    if(__tmp_root) {
+        __tmp_free(__tmp_root);
+        __tmp_root = NULL;
+    }
+}
@@ -35,6 +35,9 @@
 /*** configuration ***/
 /* #define UEFI_NO_UTF8 */                  /* use wchar_t in your application */
 /* #define UEFI_NO_TRACK_ALLOC */           /* do not track allocated buffers' size */
+/* #define UEFI_IOSTATS */                  /* count firmware I/O calls and their latency per stream */
+/* #define UEFI_WHOLE_DISKS */              /* /dev/disk(n) lists whole disks only, no partitions */
+/* #define UEFI_NVME_DEPTH 32 */            /* NVMe commands kept in flight on /dev/nvme(n) */
 /*** configuration ends ***/
 
 #ifdef  __cplusplus
@@ -75,6 +78,7 @@ typedef uint16_t wchar_t;
 #endif
 typedef uint64_t uintn_t;
 typedef uint64_t size_t;
+typedef int64_t  ssize_t;
 typedef uint64_t time_t;
 typedef uint64_t mode_t;
 typedef uint64_t off_t;
@@ -889,6 +893,8 @@ extern efi_system_table_t *ST;
 #define EFI_FILE_VALID_ATTR     0x0000000000000037
 
 #define EFI_FILE_PROTOCOL_REVISION         0x00010000
+#define EFI_FILE_PROTOCOL_REVISION2        0x00020000
+#define EFI_FILE_PROTOCOL_LATEST_REVISION  EFI_FILE_PROTOCOL_REVISION2
 #define EFI_FILE_HANDLE_REVISION           EFI_FILE_PROTOCOL_REVISION
 #endif
 
@@ -933,6 +939,17 @@ typedef efi_status_t (EFIAPI *efi_file_set_info_t)(efi_file_handle_t *File, efi_
     void *Buffer);
 typedef efi_status_t (EFIAPI *efi_file_flush_t)(efi_file_handle_t *File);
 
+typedef struct {
+    efi_event_t             Event;
+    efi_status_t            Status;
+    uintn_t                 BufferSize;
+    void                    *Buffer;
+} efi_file_io_token_t;
+
+typedef efi_status_t (EFIAPI *efi_file_open_ex_t)(efi_file_handle_t *File, efi_file_handle_t **NewHandle, wchar_t *FileName,
+    uint64_t OpenMode, uint64_t Attributes, efi_file_io_token_t *Token);
+typedef efi_status_t (EFIAPI *efi_file_io_ex_t)(efi_file_handle_t *File, efi_file_io_token_t *Token);
+
 struct efi_file_handle_s {
     uint64_t                Revision;
     efi_file_open_t         Open;
@@ -945,6 +962,11 @@ struct efi_file_handle_s {
     efi_file_get_info_t     GetInfo;
     efi_file_set_info_t     SetInfo;
     efi_file_flush_t        Flush;
+    /* revision 2 only */
+    efi_file_open_ex_t      OpenEx;
+    efi_file_io_ex_t        ReadEx;
+    efi_file_io_ex_t        WriteEx;
+    efi_file_io_ex_t        FlushEx;
 };
 
 /*** Shell Parameter Protocols ***/
@@ -1093,9 +1115,179 @@ typedef struct {
     efi_block_flush_t       FlushBlocks;
 } efi_block_io_t;
 
+#ifndef EFI_BLOCK_IO2_PROTOCOL_GUID
+#define EFI_BLOCK_IO2_PROTOCOL_GUID { 0xa77b2472, 0xe282, 0x4e9f, {0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1} }
+#endif
+
+typedef struct {
+    efi_event_t             Event;
+    efi_status_t            TransactionStatus;
+} efi_block_io2_token_t;
+
+typedef efi_status_t (EFIAPI *efi_block_read_ex_t)(void *This, uint32_t MediaId, efi_lba_t LBA, efi_block_io2_token_t *Token,
+    uintn_t BufferSize, void *Buffer);
+typedef efi_status_t (EFIAPI *efi_block_write_ex_t)(void *This, uint32_t MediaId, efi_lba_t LBA, efi_block_io2_token_t *Token,
+    uintn_t BufferSize, void *Buffer);
+typedef efi_status_t (EFIAPI *efi_block_flush_ex_t)(void *This, efi_block_io2_token_t *Token);
+
+typedef struct {
+    efi_block_io_media_t    *Media;
+    efi_block_reset_t       Reset;
+    efi_block_read_ex_t     ReadBlocksEx;
+    efi_block_write_ex_t    WriteBlocksEx;
+    efi_block_flush_ex_t    FlushBlocksEx;
+} efi_block_io2_t;
+
+/*** Disk IO Protocols ***/
+#ifndef EFI_DISK_IO_PROTOCOL_GUID
+#define EFI_DISK_IO_PROTOCOL_GUID { 0xce345171, 0xba0b, 0x11d2, {0x8e, 0x4f, 0x0, 0xa0, 0xc9, 0x69, 0x72, 0x3b} }
+
+#define EFI_DISK_IO_PROTOCOL_REVISION     0x00010000
+#endif
+
+#ifndef EFI_DISK_IO2_PROTOCOL_GUID
+#define EFI_DISK_IO2_PROTOCOL_GUID { 0x151c8eae, 0x7f2c, 0x472c, {0x9e, 0x54, 0x98, 0x28, 0x19, 0x4f, 0x6a, 0x88} }
+
+#define EFI_DISK_IO2_PROTOCOL_REVISION    0x00020000
+#endif
+
+typedef efi_status_t (EFIAPI *efi_disk_read_t)(void *This, uint32_t MediaId, uint64_t Offset, uintn_t BufferSize, void *Buffer);
+typedef efi_status_t (EFIAPI *efi_disk_write_t)(void *This, uint32_t MediaId, uint64_t Offset, uintn_t BufferSize, void *Buffer);
+
+typedef struct {
+    uint64_t                Revision;
+    efi_disk_read_t         ReadDisk;
+    efi_disk_write_t        WriteDisk;
+} efi_disk_io_t;
+
+typedef struct {
+    efi_event_t             Event;
+    efi_status_t            TransactionStatus;
+} efi_disk_io2_token_t;
+
+typedef efi_status_t (EFIAPI *efi_disk_cancel_t)(void *This);
+typedef efi_status_t (EFIAPI *efi_disk_read_ex_t)(void *This, uint32_t MediaId, uint64_t Offset, efi_disk_io2_token_t *Token,
+    uintn_t BufferSize, void *Buffer);
+typedef efi_status_t (EFIAPI *efi_disk_write_ex_t)(void *This, uint32_t MediaId, uint64_t Offset, efi_disk_io2_token_t *Token,
+    uintn_t BufferSize, void *Buffer);
+typedef efi_status_t (EFIAPI *efi_disk_flush_ex_t)(void *This, efi_disk_io2_token_t *Token);
+
+typedef struct {
+    uint64_t                Revision;
+    efi_disk_cancel_t       Cancel;
+    efi_disk_read_ex_t      ReadDiskEx;
+    efi_disk_write_ex_t     WriteDiskEx;
+    efi_disk_flush_ex_t     FlushDiskEx;
+} efi_disk_io2_t;
+
+/*** NVM Express Pass Thru Protocol ***/
+#ifndef EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL_GUID
+#define EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL_GUID { 0x52c78312, 0x8edc, 0x4233, {0x98, 0xf2, 0x1a, 0x1a, 0xa5, 0xe3, 0x88, 0xa5} }
+#endif
+
+#define EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_PHYSICAL    0x0001
+#define EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_LOGICAL     0x0002
+#define EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_NONBLOCKIO  0x0004
+#define EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_CMD_SET_NVM 0x0008
+
+#define CDW2_VALID  0x01
+#define CDW3_VALID  0x02
+#define CDW10_VALID 0x04
+#define CDW11_VALID 0x08
+#define CDW12_VALID 0x10
+#define CDW13_VALID 0x20
+#define CDW14_VALID 0x40
+#define CDW15_VALID 0x80
+
+#define NVME_ADMIN_QUEUE 0x00
+#define NVME_IO_QUEUE    0x01
+
+typedef struct {
+    uint32_t                Attributes;
+    uint32_t                IoAlign;
+    uint32_t                NvmeVersion;
+} efi_nvme_pass_thru_mode_t;
+
+typedef struct {
+    uint32_t                Cdw0;       /* opcode in bits 0-7, fused operation in bits 8-9 */
+    uint8_t                 Flags;
+    uint32_t                Nsid;
+    uint32_t                Cdw2;
+    uint32_t                Cdw3;
+    uint32_t                Cdw10;
+    uint32_t                Cdw11;
+    uint32_t                Cdw12;
+    uint32_t                Cdw13;
+    uint32_t                Cdw14;
+    uint32_t                Cdw15;
+} efi_nvme_command_t;
+
+typedef struct {
+    uint32_t                DW0;
+    uint32_t                DW1;
+    uint32_t                DW2;
+    uint32_t                DW3;        /* status field in bits 17-31 */
+} efi_nvme_completion_t;
+
+typedef struct {
+    uint64_t                CommandTimeout;     /* in 100ns units, 0 waits forever */
+    void                    *TransferBuffer;
+    uint32_t                TransferLength;
+    void                    *MetadataBuffer;
+    uint32_t                MetadataLength;
+    uint8_t                 QueueType;
+    efi_nvme_command_t      *NvmeCmd;
+    efi_nvme_completion_t   *NvmeCompletion;
+} efi_nvme_packet_t;
+
+typedef efi_status_t (EFIAPI *efi_nvme_pass_thru_func_t)(void *This, uint32_t NamespaceId, efi_nvme_packet_t *Packet,
+    efi_event_t Event);
+typedef efi_status_t (EFIAPI *efi_nvme_get_next_namespace_t)(void *This, uint32_t *NamespaceId);
+typedef efi_status_t (EFIAPI *efi_nvme_build_device_path_t)(void *This, uint32_t NamespaceId, efi_device_path_t **DevicePath);
+typedef efi_status_t (EFIAPI *efi_nvme_get_namespace_t)(void *This, efi_device_path_t *DevicePath, uint32_t *NamespaceId);
+
+typedef struct {
+    efi_nvme_pass_thru_mode_t       *Mode;
+    efi_nvme_pass_thru_func_t       PassThru;
+    efi_nvme_get_next_namespace_t   GetNextNamespace;
+    efi_nvme_build_device_path_t    BuildDevicePath;
+    efi_nvme_get_namespace_t        GetNamespace;
+} efi_nvme_pass_thru_t;
+
+#ifdef UEFI_IOSTATS
+#define IOSTAT_READ     0
+#define IOSTAT_WRITE    1
+#define IOSTAT_OTHER    2   /* open, seek, info, flush, close */
+#define IOSTAT_MAX      3
+#define IOSTAT_BUCKETS  40
+typedef struct {
+    uint64_t                calls;
+    uint64_t                bytes;
+    uint64_t                cycles;
+    uint64_t                hist[IOSTAT_BUCKETS];   /* number of calls by log2 of cycles */
+} iostat_t;
+#endif
+
 typedef struct {
     off_t                   offset;
+    efi_handle_t            handle;
+    efi_block_io_media_t    media;      /* cached copy, refreshed when MediaId changes */
     efi_block_io_t          *bio;
+    efi_block_io2_t         *bio2;      /* asynchronous access, NULL if not available */
+    efi_disk_io_t           *dio;       /* byte granular access, NULL if not available */
+    efi_disk_io2_t          *dio2;
+    void                    *cache;     /* private, block cache set up by setvbuf */
+    void                    *ahead;     /* private, readahead of sequential freads */
+    off_t                   start;      /* partitions only, their position and size on the disk in bytes */
+    off_t                   size;
+    void                    *disk;      /* private, the whole disk of a partition, NULL for disks */
+    void                    *gpt;       /* private, the parsed partition table of a disk */
+    efi_nvme_pass_thru_t    *nvme;      /* NVMe namespaces only, NULL for disks */
+    uint32_t                nsid;
+    void                    *queue;     /* private, NVMe commands in flight */
+#ifdef UEFI_IOSTATS
+    iostat_t                iostat[IOSTAT_MAX];
+#endif
 } block_file_t;
 
 /*** Graphics Output Protocol (not used, but could be useful to have) ***/
@@ -1227,7 +1419,7 @@ typedef struct {
   efi_pci_option_rom_descriptor_t   *PciOptionRomDescriptors;
 } efi_pci_option_rom_table_t;
 
-/*** GPT partitioning table (not used, but could be useful to have) ***/
+/*** GPT partitioning table ***/
 typedef struct {
     efi_table_header_t  Header;
     efi_lba_t           MyLBA;
@@ -1307,6 +1499,72 @@ extern int errno;
 #define	EPIPE		32	/* Broken pipe */
 #define	EDOM		33	/* Math argument out of domain of func */
 #define	ERANGE		34	/* Math result not representable */
+#define	ENAMETOOLONG	36	/* File name too long */
+#define	ENOTEMPTY	39	/* Directory not empty */
+#define	EINPROGRESS	115	/* Operation now in progress */
+
+/* math.h */
+#define M_E         2.7182818284590452354   /* e */
+#define M_LN2       0.69314718055994530942  /* log_e 2 */
+#define M_LN10      2.30258509299404568402  /* log_e 10 */
+#define M_PI        3.14159265358979323846  /* pi */
+#define M_PI_2      1.57079632679489661923  /* pi/2 */
+#define M_PI_4      0.78539816339744830962  /* pi/4 */
+#define M_SQRT2     1.41421356237309504880  /* sqrt(2) */
+#define HUGE_VAL    (__builtin_huge_val())
+#define HUGE_VALF   (__builtin_huge_valf())
+#define INFINITY    (__builtin_inff())
+#define NAN         (__builtin_nanf(""))
+#define isnan(x)    __builtin_isnan(x)
+#define isinf(x)    __builtin_isinf(x)
+#define isfinite(x) __builtin_isfinite(x)
+#define signbit(x)  __builtin_signbit(x)
+extern double fabs (double __x);
+extern double copysign (double __x, double __y);
+extern double trunc (double __x);
+extern double floor (double __x);
+extern double ceil (double __x);
+extern double round (double __x);
+extern double fmod (double __x, double __y);
+extern double ldexp (double __x, int __exp);
+extern double frexp (double __x, int *__exp);
+extern double sqrt (double __x);
+extern double hypot (double __x, double __y);
+extern double exp (double __x);
+extern double log (double __x);
+extern double log2 (double __x);
+extern double log10 (double __x);
+extern double pow (double __x, double __y);
+extern double sin (double __x);
+extern double cos (double __x);
+extern double tan (double __x);
+extern double atan (double __x);
+extern double atan2 (double __y, double __x);
+extern double asin (double __x);
+extern double acos (double __x);
+extern float fabsf (float __x);
+extern float sqrtf (float __x);
+extern float floorf (float __x);
+extern float ceilf (float __x);
+extern float truncf (float __x);
+extern float roundf (float __x);
+extern float fmodf (float __x, float __y);
+extern float sinf (float __x);
+extern float cosf (float __x);
+extern float tanf (float __x);
+extern float atanf (float __x);
+extern float atan2f (float __y, float __x);
+extern float expf (float __x);
+extern float logf (float __x);
+extern float log2f (float __x);
+extern float powf (float __x, float __y);
+/* batched variants, replace __n floats in place with the function's result, 4 at a time */
+extern void vsqrtf (float *__x, size_t __n);
+extern void vexpf (float *__x, size_t __n);
+extern void vlogf (float *__x, size_t __n);
+extern void vpowf (float *__x, size_t __n, float __y);
+extern void vsinf (float *__x, size_t __n);
+extern void vcosf (float *__x, size_t __n);
 
 /* stdlib.h */
 #define RAND_MAX       2147483647
@@ -1314,6 +1572,11 @@ typedef int (*__compar_fn_t) (const void *, const void *);
 extern int atoi (const char_t *__nptr);
 extern int64_t atol (const char_t *__nptr);
 extern int64_t strtol (const char_t *__nptr, char_t **__endptr, int __base);
+extern int64_t strtoll (const char_t *__nptr, char_t **__endptr, int __base);
+extern uint64_t strtoul (const char_t *__nptr, char_t **__endptr, int __base);
+extern uint64_t strtoull (const char_t *__nptr, char_t **__endptr, int __base);
+extern double strtod (const char_t *__nptr, char_t **__endptr);
+extern double atof (const char_t *__nptr);
 extern void *malloc (size_t __size);
 extern void *calloc (size_t __nmemb, size_t __size);
 extern void *realloc (void *__ptr, size_t __size);
@@ -1331,6 +1594,9 @@ extern size_t mbstowcs (wchar_t *__pwcs, const char *__s, size_t __n);
 extern size_t wcstombs (char *__s, const wchar_t *__pwcs, size_t __n);
 extern void srand(unsigned int __seed);
 extern int rand(void);
+extern uint32_t arc4random(void);
+extern void arc4random_buf(void *__buf, size_t __n);
+extern uint32_t arc4random_uniform(uint32_t __upper_bound);
 extern uint8_t *getenv(char_t *name, uintn_t *len);
 extern int setenv(char_t *name, uintn_t len, uint8_t *data);
 
@@ -1341,19 +1607,61 @@ extern int setenv(char_t *name, uintn_t len, uint8_t *data);
 #define SEEK_SET	0	/* Seek from beginning of file.  */
 #define SEEK_CUR	1	/* Seek from current position.  */
 #define SEEK_END	2	/* Seek from end of file.  */
+#define EOF (-1)
+#define _IOFBF 0    /* fully buffered */
+#define _IOLBF 1    /* line buffered */
+#define _IONBF 2    /* unbuffered */
 #define stdin (FILE*)ST->ConsoleInHandle
 #define stdout (FILE*)ST->ConsoleOutHandle
 #define stderr (FILE*)ST->ConsoleErrorHandle
-typedef struct efi_file_handle_s FILE;
+typedef struct {
+    efi_file_handle_t   *fh;        /* firmware file handle */
+    uint8_t             *buf;       /* stream buffer, allocated on first use */
+    size_t              bufsiz;
+    size_t              pos;        /* read or write index in buffer */
+    size_t              len;        /* read ahead bytes in buffer */
+    int                 mode;       /* _IOFBF, _IOLBF or _IONBF */
+    int                 flags;
+    off_t               off;        /* cached position, buffered data included */
+    off_t               size;       /* cached file size */
+#ifdef UEFI_IOSTATS
+    iostat_t            iostat[IOSTAT_MAX];
+    char_t              iostat_name[32];
+#endif
+} FILE;
 extern int fclose (FILE *__stream);
 extern int fflush (FILE *__stream);
+extern int setvbuf (FILE *__stream, char *__buf, int __modes, size_t __n);
+extern void setbuf (FILE *__stream, char *__buf);
 extern int remove (const char_t *__filename);
 extern FILE *fopen (const char_t *__filename, const char_t *__modes);
+extern FILE *fopenat (DIR *__dirp, const char_t *__filename, const char_t *__modes);
+#ifdef UEFI_IOSTATS
+extern int fiostat (FILE *__stream, iostat_t *__st);
+#endif
+extern void *map_file (const char_t *__filename, size_t *__size);
+extern int unmap_file (void *__addr, size_t __size);
+extern int mount_archive (const char_t *__archive, const char_t *__path);
+extern int umount_archive (const char_t *__path);
+typedef struct {
+    off_t       total;      /* size of the source file */
+    off_t       done;       /* bytes copied so far */
+    uint64_t    usec;       /* time elapsed */
+    uint64_t    bps;        /* throughput in bytes per second */
+} copy_stat_t;
+typedef void (*copy_progress_t)(const copy_stat_t *__stat);
+extern int copy_file (const char_t *__src, const char_t *__dst, copy_progress_t __progress);
 extern size_t fread (void *__ptr, size_t __size, size_t __n, FILE *__stream);
 extern size_t fwrite (const void *__ptr, size_t __size, size_t __n, FILE *__s);
 extern int fseek (FILE *__stream, long int __off, int __whence);
 extern long int ftell (FILE *__stream);
 extern int feof (FILE *__stream);
+extern int fgetc (FILE *__stream);
+extern char_t *fgets (char_t *__s, int __n, FILE *__stream);
+extern int fputc (int __c, FILE *__stream);
+extern int fputs (const char_t *__s, FILE *__stream);
+#define getc(s) fgetc(s)
+#define putc(c,s) fputc(c,s)
 extern int fprintf (FILE *__stream, const char_t *__format, ...);
 extern int printf (const char_t *__format, ...);
 extern int sprintf (char_t *__s, const char_t *__format, ...);
@@ -1415,6 +1723,7 @@ struct stat {
 };
 extern int stat (const char_t *__file, struct stat *__buf);
 extern int fstat (FILE *__f, struct stat *__buf);
+extern int fstatat (DIR *__dirp, const char_t *__file, struct stat *__buf, int __flag);
 extern int mkdir (const char_t *__path, mode_t __mode);
 
 /* time.h */
@@ -1429,6 +1738,10 @@ struct tm {
   int tm_yday;  /* Days in year.[0-365] (not set) */
   int tm_isdst; /* DST.     [-1/0/1]*/
 };
+struct timespec {
+    time_t      tv_sec;
+    long        tv_nsec;
+};
 extern struct tm *localtime (const time_t *__timer);
 extern time_t mktime(const struct tm *__tm);
 extern time_t time(time_t *__timer);
@@ -1438,6 +1751,35 @@ extern unsigned int sleep (unsigned int __seconds);
 extern int usleep (unsigned long int __useconds);
 extern int unlink (const wchar_t *__filename);
 extern int rmdir (const wchar_t *__filename);
+extern int ftruncate (FILE *__stream, off_t __length);
+
+/* fcntl.h */
+extern int posix_fallocate (FILE *__stream, off_t __offset, off_t __len);
+
+/* sys/uio.h */
+struct iovec {
+    void        *iov_base;
+    size_t      iov_len;
+};
+extern ssize_t readv (FILE *__stream, const struct iovec *__iov, int __iovcnt);
+extern ssize_t writev (FILE *__stream, const struct iovec *__iov, int __iovcnt);
+
+/* aio.h */
+struct aiocb {
+    FILE                *aio_fildes;
+    off_t               aio_offset;
+    volatile void       *aio_buf;
+    size_t              aio_nbytes;
+    /* private */
+    efi_file_io_token_t __token;
+    int                 __op;
+    int                 __err;
+};
+extern int aio_read (struct aiocb *__aiocbp);
+extern int aio_write (struct aiocb *__aiocbp);
+extern int aio_error (const struct aiocb *__aiocbp);
+extern ssize_t aio_return (struct aiocb *__aiocbp);
+extern int aio_suspend (const struct aiocb *const __list[], int __nent, const struct timespec *__timeout);
 
 #ifdef  __cplusplus
 }